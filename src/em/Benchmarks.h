@@ -0,0 +1,249 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxJSON.h"
+#include "MeshGenerator.h"
+#include "ChordSynth.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Headless microbenchmarks for the per-frame hot paths. Each benchmark
+    // reports the fastest time per call over several samples. The results go to a
+    // JSON file and, given a baseline from an earlier run, any benchmark
+    // slower than the baseline by more than the threshold counts as a
+    // regression. Nothing here touches GL, so it runs on machines with no GPU.
+    class Benchmarks {
+
+    public:
+
+        struct Settings {
+            string      outPath         = "bench.json";
+            string      baselinePath;
+            bool        updateBaseline  = false;
+            float       threshold       = 0.1f;     // allowed slowdown, 0.1 is 10%
+            double      minSeconds      = 0.25;     // per benchmark
+        };
+
+    private:
+
+        struct Result {
+            string  name;
+            double  nsPerOp;
+            int     iterations;
+        };
+
+        typedef chrono::steady_clock Clock;
+
+        static double seconds(Clock::time_point since){
+            return chrono::duration<double>(Clock::now() - since).count();
+        }
+
+        // Doubles the batch until a sample is long enough to time, stops once
+        // minSeconds and at least five samples were spent, keeps the fastest
+        template <typename F>
+        void measure(const string& name, F fn){
+            fn();
+            int batch = 1, total = 0, samples = 0;
+            double best = numeric_limits<double>::max();
+            auto start = Clock::now();
+            while (samples < 5 || seconds(start) < settings.minSeconds) {
+                auto t0 = Clock::now();
+                for (int i = 0; i < batch; i++) fn();
+                double t = seconds(t0);
+                best = min(best, t * 1e9 / batch);
+                total += batch;
+                samples++;
+                if (t < settings.minSeconds / 50) batch *= 2;
+            }
+            record(name, best, total);
+        }
+
+        // For calls that grow state: every sample times `calls` calls on a
+        // fresh state from `setup`, which is left out of the timing. Stops
+        // like measure() and keeps the fastest sample.
+        template <typename S, typename F>
+        void measureFresh(const string& name, int calls, S setup, F fn){
+            int samples = 0;
+            double best = numeric_limits<double>::max();
+            auto start = Clock::now();
+            while (samples < 5 || seconds(start) < settings.minSeconds) {
+                auto state = setup();
+                auto t0 = Clock::now();
+                for (int i = 0; i < calls; i++) fn(*state);
+                best = min(best, seconds(t0) * 1e9 / calls);
+                samples++;
+            }
+            record(name, best, samples * calls);
+        }
+
+        void record(const string& name, double nsPerOp, int iterations){
+            Result r;
+            r.name = name;
+            r.nsPerOp = nsPerOp;
+            r.iterations = iterations;
+            results.push_back(r);
+            ofLogNotice("Benchmarks") << name << ": " << nsPerOp / 1000 << " us";
+        }
+
+        // Generator with a k-nearest cluster, same setup as the app uses
+        void populate(MeshGenerator& gen, int particles){
+            ofSeedRandom(1);
+            gen.setup();
+            gen.makeClusterBatch(particles, CLUSTER_KNN, 4);
+        }
+
+        void benchPhysics(){
+            for (int n : { 1000, 5000, 20000 }) {
+                MeshGenerator gen;
+                populate(gen, n);
+                measure("physics.update/" + ofToString(n), [&]{ gen.getPhysics().update(); });
+            }
+        }
+
+        void benchMeshRebuild(){
+            for (int n : { 1000, 5000, 20000 }) {
+                MeshGenerator gen;
+                populate(gen, n);
+                gen.physicsPaused = true;
+                measure("updatePhysics.rebuild/" + ofToString(n), [&]{ gen.stepNow(); });
+            }
+        }
+
+        void benchInsertion(){
+            {
+                // An existing pair at the end of the spring list, so every call scans all springs
+                MeshGenerator gen;
+                populate(gen, 5000);
+                auto& physics = gen.getPhysics();
+                auto spring = physics.getSpring(physics.numberOfSprings() - 1);
+                auto a = spring->getOneEnd();
+                auto b = spring->getTheOtherEnd();
+                string name = "makeSpringBetweenParticles/" + ofToString(physics.numberOfSprings());
+                measure(name, [&]{ gen.makeSpringBetweenParticles(a, b); });
+            }
+            measureFresh("makeCluster/1000+200", 200, [&]{
+                unique_ptr<MeshGenerator> gen(new MeshGenerator);
+                populate(*gen, 1000);
+                return gen;
+            }, [](MeshGenerator& gen){ gen.makeCluster(); });
+            measureFresh("makeClusterBatch/5000", 1, [&]{
+                unique_ptr<MeshGenerator> gen(new MeshGenerator);
+                ofSeedRandom(1);
+                gen->setup();
+                return gen;
+            }, [](MeshGenerator& gen){ gen.makeClusterBatch(5000, CLUSTER_KNN, 4); });
+        }
+
+        void benchZDepth(){
+            for (int n : { 5000, 20000 }) {
+                MeshGenerator gen;
+                populate(gen, n);
+                measure("setZDepth/" + ofToString(n), [&]{ gen.setZDepth(50); });
+            }
+        }
+
+        void benchAudio(){
+            ChordSynth synth;
+            synth.setup(44100);
+            ofSoundBuffer buffer;
+            buffer.allocate(512, 2);
+            measure("audioOut/512", [&]{ synth.process(buffer); });
+        }
+
+        // A recording frame read back as floats and converted to 8 bit
+        void benchPixelConversion(){
+            ofFloatPixels source;
+            source.allocate(FBO_WIDTH, FBO_HEIGHT, OF_PIXELS_RGB);
+            float* data = source.getData();
+            for (size_t i = 0; i < source.size(); i++) data[i] = (i % 256) / 255.f;
+            ofPixels bytes;
+            measure("floatToBytes/" + ofToString(FBO_WIDTH) + "x" + ofToString(FBO_HEIGHT), [&]{ bytes = source; });
+        }
+
+        void save(const string& path) const {
+            ofxJSONElement json;
+            json["threads"] = WorkerPool::shared().size();
+            for (auto & r : results) {
+                Json::Value entry;
+                entry["name"] = r.name;
+                entry["ns_per_op"] = r.nsPerOp;
+                entry["iterations"] = r.iterations;
+                json["benchmarks"].append(entry);
+            }
+            json.save(path, true);
+        }
+
+        // Number of benchmarks slower than their baseline beyond the threshold
+        int compare(const string& path) const {
+            ofxJSONElement baseline;
+            if (!baseline.open(path)) {
+                ofLogWarning("Benchmarks") << "no baseline at " << path;
+                return 0;
+            }
+            map<string, double> previous;
+            const Json::Value& entries = baseline["benchmarks"];
+            for (Json::ArrayIndex i = 0; i < entries.size(); i++) {
+                previous[entries[i]["name"].asString()] = entries[i]["ns_per_op"].asDouble();
+            }
+            int regressions = 0;
+            for (auto & r : results) {
+                auto found = previous.find(r.name);
+                if (found == previous.end() || found->second <= 0) continue;
+                double change = r.nsPerOp / found->second - 1;
+                string line = r.name + ": " + ofToString(change * 100, 1) + "% vs baseline";
+                if (change > settings.threshold) {
+                    ofLogError("Benchmarks") << line << ", regression";
+                    regressions++;
+                } else {
+                    ofLogNotice("Benchmarks") << line;
+                }
+            }
+            return regressions;
+        }
+
+        Settings        settings;
+        vector<Result>  results;
+
+    public:
+
+        // Reads --bench and its options, false when not a benchmark run
+        static bool parseArgs(int argc, char* argv[], Settings& settings){
+            bool bench = false;
+            for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                bool hasValue = i + 1 < argc;
+                if (arg == "--bench")                           bench = true;
+                else if (arg == "--baseline" && hasValue)       settings.baselinePath = argv[++i];
+                else if (arg == "--update-baseline")            settings.updateBaseline = true;
+                else if (arg == "--threshold" && hasValue)      settings.threshold = ofToFloat(argv[++i]);
+                else if (arg == "--bench-time" && hasValue)     settings.minSeconds = ofToDouble(argv[++i]);
+                else if (arg == "--out" && hasValue)            settings.outPath = argv[++i];
+            }
+            return bench;
+        }
+
+        // Runs everything, returns the number of regressions against the baseline
+        int run(const Settings& s){
+            settings = s;
+            results.clear();
+            benchPhysics();
+            benchMeshRebuild();
+            benchInsertion();
+            benchZDepth();
+            benchAudio();
+            benchPixelConversion();
+            save(settings.outPath);
+
+            int regressions = 0;
+            if (!settings.baselinePath.empty()) {
+                regressions = compare(settings.baselinePath);
+                if (settings.updateBaseline) save(settings.baselinePath);
+            }
+            ofLogNotice("Benchmarks") << results.size() << " benchmarks, " << regressions
+                                      << " regressions, results in " << settings.outPath;
+            return regressions;
+        }
+    };
+}
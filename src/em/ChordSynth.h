@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+namespace em {
+    // Three sine oscillators forming a chord, each pulsed by its own LFO
+    class ChordSynth {
+
+        double  sampleRate;
+        double  wavePhase;
+        double  pulsePhase;
+
+    public:
+
+        ChordSynth(){
+            setup(44100);
+        }
+
+        void setup(double rate){
+            sampleRate = rate;
+            wavePhase = 0;
+            pulsePhase = 0;
+        }
+
+        void process(ofSoundBuffer &outBuffer){
+            // base frequency of the lowest sine wave in cycles per second (hertz)
+            float frequency = 172.5;
+
+            // mapping frequencies from Hz into full oscillations of sin() (two pi)
+            float wavePhaseStep = (frequency / sampleRate) * TWO_PI;
+            float pulsePhaseStep = (0.5 / sampleRate) * TWO_PI;
+
+            // this loop builds a buffer of audio containing 3 sine waves at different
+            // frequencies, and pulses the volume of each sine wave individually. In
+            // other words, 3 oscillators and 3 LFOs.
+
+            for(size_t i = 0; i < outBuffer.getNumFrames(); i++) {
+
+                // build up a chord out of sine waves at 3 different frequencies
+                float sampleLow = sin(wavePhase);
+                float sampleMid = sin(wavePhase * 1.5);
+                float sampleHi = sin(wavePhase * 2.0);
+
+                // pulse each sample's volume
+                sampleLow *= sin(pulsePhase);
+                sampleMid *= sin(pulsePhase * 1.04);
+                sampleHi *= sin(pulsePhase * 1.09);
+
+                float fullSample = (sampleLow + sampleMid + sampleHi);
+
+                // reduce the full sample's volume so it doesn't exceed 1
+                fullSample *= 0.3;
+
+                // write the computed sample to the left and right channels
+                outBuffer.getSample(i, 0) = fullSample;
+                outBuffer.getSample(i, 1) = fullSample;
+
+                // get the two phase variables ready for the next sample
+                wavePhase += wavePhaseStep;
+                pulsePhase += pulsePhaseStep;
+            }
+        }
+    };
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "ofMain.h"
+#include <unordered_map>
+
+
+namespace em {
+
+    enum ClusterTopology {
+        CLUSTER_CHAIN = 0,
+        CLUSTER_RING,
+        CLUSTER_KNN,
+        CLUSTER_LATTICE,
+        CLUSTER_TOPOLOGY_COUNT
+    };
+
+    // Bucketed points for radius and k-nearest queries
+    class SpatialHash {
+
+        static uint64_t key(int x, int y, int z){
+            return ((uint64_t) (x & 0x1fffff) << 42) | ((uint64_t) (y & 0x1fffff) << 21) | (uint64_t) (z & 0x1fffff);
+        }
+
+        int coord(float v) const {
+            return (int) floor(v * invCellSize);
+        }
+
+        const vector<ofVec3f>*                      points;
+        float                                       cellSize, invCellSize;
+        vector<pair<uint64_t, uint32_t>>            entries;
+        unordered_map<uint64_t, pair<uint32_t, uint32_t>> cells;
+
+    public:
+
+        void build(const vector<ofVec3f>& pts, float size){
+            points = &pts;
+            cellSize = max(size, 0.0001f);
+            invCellSize = 1.f / cellSize;
+            entries.resize(pts.size());
+            for (size_t i = 0; i < pts.size(); i++) {
+                entries[i] = make_pair(key(coord(pts[i].x), coord(pts[i].y), coord(pts[i].z)), (uint32_t) i);
+            }
+            sort(entries.begin(), entries.end());
+            cells.clear();
+            cells.reserve(entries.size());
+            for (uint32_t i = 0; i < entries.size(); ) {
+                uint32_t j = i;
+                while (j < entries.size() && entries[j].first == entries[i].first) j++;
+                cells[entries[i].first] = make_pair(i, j);
+                i = j;
+            }
+        }
+
+        template <typename F>
+        void forEachInCell(int x, int y, int z, F f) const {
+            auto it = cells.find(key(x, y, z));
+            if (it == cells.end()) return;
+            for (uint32_t s = it->second.first; s < it->second.second; s++) f(entries[s].second);
+        }
+
+        void queryRadius(const ofVec3f& p, float radius, vector<uint32_t>& out) const {
+            out.clear();
+            int reach = ceil(radius * invCellSize);
+            int cx = coord(p.x), cy = coord(p.y), cz = coord(p.z);
+            float r2 = radius * radius;
+            for (int z = cz - reach; z <= cz + reach; z++)
+                for (int y = cy - reach; y <= cy + reach; y++)
+                    for (int x = cx - reach; x <= cx + reach; x++)
+                        forEachInCell(x, y, z, [&](uint32_t j){
+                            if ((*points)[j].squareDistance(p) <= r2) out.push_back(j);
+                        });
+        }
+
+        // k nearest to point `self`, expanding shells of cells until no
+        // closer point can remain outside the searched block
+        void queryNearest(uint32_t self, int k, vector<uint32_t>& out) const {
+            out.clear();
+            const ofVec3f& p = (*points)[self];
+            int cx = coord(p.x), cy = coord(p.y), cz = coord(p.z);
+            vector<pair<float, uint32_t>> best;     // max heap on distance
+            size_t total = points->size();
+            for (int ring = 0; ; ring++) {
+                for (int z = cz - ring; z <= cz + ring; z++)
+                    for (int y = cy - ring; y <= cy + ring; y++)
+                        for (int x = cx - ring; x <= cx + ring; x++) {
+                            if (max(abs(x - cx), max(abs(y - cy), abs(z - cz))) != ring) continue;
+                            forEachInCell(x, y, z, [&](uint32_t j){
+                                if (j == self) return;
+                                float d = (*points)[j].squareDistance(p);
+                                if ((int) best.size() < k) {
+                                    best.push_back(make_pair(d, j));
+                                    push_heap(best.begin(), best.end());
+                                } else if (d < best.front().first) {
+                                    pop_heap(best.begin(), best.end());
+                                    best.back() = make_pair(d, j);
+                                    push_heap(best.begin(), best.end());
+                                }
+                            });
+                        }
+                float covered = ring * cellSize;
+                bool full = (int) best.size() >= k || best.size() + 1 >= total;
+                if (full && (best.empty() || best.front().first <= covered * covered)) break;
+                if (ring > 1024) break;
+            }
+            for (auto & b : best) out.push_back(b.second);
+        }
+    };
+
+    // Generates particle positions and a deduplicated spring edge list for
+    // a whole cluster in one go. Edges come from spatial neighbour queries,
+    // chains and rings follow a Morton (Z-order) walk so consecutive links
+    // stay short.
+    class ClusterBuilder {
+
+        static uint32_t spreadBits(uint32_t v){
+            v &= 0x3ff;
+            v = (v | (v << 16)) & 0x030000ff;
+            v = (v | (v << 8))  & 0x0300f00f;
+            v = (v | (v << 4))  & 0x030c30c3;
+            v = (v | (v << 2))  & 0x09249249;
+            return v;
+        }
+
+        void addEdge(uint32_t a, uint32_t b){
+            if (a == b) return;
+            edges.push_back(a < b ? make_pair(a, b) : make_pair(b, a));
+        }
+
+        void makePositions(int count, ClusterTopology topology, float extent){
+            positions.resize(count);
+            if (topology == CLUSTER_LATTICE) {
+                int side = max((int) ceil(cbrt((double) count)), 1);
+                spacing = extent * 2 / side;
+                float origin = -spacing * (side - 1) / 2;
+                for (int i = 0; i < count; i++) {
+                    int x = i % side, y = (i / side) % side, z = i / (side * side);
+                    positions[i].set(origin + x * spacing, origin + y * spacing, origin + z * spacing);
+                }
+            } else {
+                for (int i = 0; i < count; i++) {
+                    positions[i].set(ofRandom(-extent, extent), ofRandom(-extent, extent), ofRandom(-extent, extent));
+                }
+                spacing = extent * 2 / max(cbrt(count / 2.0), 1.0);
+            }
+        }
+
+        void linkMortonOrder(float extent, bool closed){
+            size_t n = positions.size();
+            vector<pair<uint32_t, uint32_t>> order(n);
+            float scale = 1023.f / (extent * 2);
+            for (size_t i = 0; i < n; i++) {
+                const ofVec3f& p = positions[i];
+                uint32_t x = ofClamp((p.x + extent) * scale, 0.f, 1023.f);
+                uint32_t y = ofClamp((p.y + extent) * scale, 0.f, 1023.f);
+                uint32_t z = ofClamp((p.z + extent) * scale, 0.f, 1023.f);
+                order[i] = make_pair(spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2), (uint32_t) i);
+            }
+            sort(order.begin(), order.end());
+            for (size_t i = 1; i < n; i++) addEdge(order[i - 1].second, order[i].second);
+            if (closed && n > 2) addEdge(order[n - 1].second, order[0].second);
+        }
+
+        vector<ofVec3f>                     positions;
+        vector<pair<uint32_t, uint32_t>>    edges;
+        float                               spacing;
+        SpatialHash                         hash;
+
+    public:
+
+        void build(int count, ClusterTopology topology, float extent, int neighbours=4){
+            edges.clear();
+            makePositions(max(count, 0), topology, max(extent, 1.f));
+            if (positions.size() < 2) return;
+
+            vector<uint32_t> found;
+            switch (topology) {
+                case CLUSTER_CHAIN:
+                case CLUSTER_RING:
+                    linkMortonOrder(extent, topology == CLUSTER_RING);
+                    break;
+                case CLUSTER_KNN:
+                    hash.build(positions, spacing);
+                    edges.reserve(positions.size() * neighbours);
+                    for (uint32_t i = 0; i < positions.size(); i++) {
+                        hash.queryNearest(i, neighbours, found);
+                        for (auto j : found) addEdge(i, j);
+                    }
+                    break;
+                case CLUSTER_LATTICE:
+                    hash.build(positions, spacing);
+                    edges.reserve(positions.size() * 6);
+                    for (uint32_t i = 0; i < positions.size(); i++) {
+                        hash.queryRadius(positions[i], spacing * 1.01f, found);
+                        for (auto j : found) if (j > i) addEdge(i, j);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            sort(edges.begin(), edges.end());
+            edges.erase(unique(edges.begin(), edges.end()), edges.end());
+        }
+
+        const vector<ofVec3f>& getPositions() const { return positions; }
+        const vector<pair<uint32_t, uint32_t>>& getEdges() const { return edges; }
+    };
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "WorkerPool.h"
+
+
+namespace em {
+    // Particle collisions through a uniform hash grid. The grid is rebuilt
+    // every step with a parallel counting sort (per-worker histograms,
+    // prefix sum, stable scatter), cells are as wide as the largest
+    // particle diameter so only the 27 surrounding cells need checking.
+    // Narrow phase runs per particle across the worker pool and resolves
+    // each overlapping pair once, from its lower index: overlap is split
+    // by inverse mass and the approaching normal velocity is reflected
+    // with each particle's own bounce, as MSA does at the world edges.
+    // Both ends go into the worker's own correction arrays, which are then
+    // summed per particle in parallel.
+    class CollisionGrid {
+
+        struct Body {
+            float x, y, z, r, w;    // w is the inverse mass, 0 when fixed
+            float bounce;
+            ofVec3f velocity;
+        };
+
+        // One worker's share of the resolution, all zero between steps
+        struct Accumulator {
+            vector<ofVec3f>     corrections, impulses;
+            int                 contacts;
+        };
+
+        uint32_t hashCell(int x, int y, int z) const {
+            return ((uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u ^ (uint32_t) z * 83492791u) & tableMask;
+        }
+
+        int cellCoord(float v) const {
+            return (int) floor(v * invCellSize);
+        }
+
+        void pack(msa::physics::World3D& physics){
+            size_t n = physics.numberOfParticles();
+            particles.clear();
+            bodies.clear();
+            float maxRadius = 0;
+            for (size_t i = 0; i < n; i++) {
+                auto p = physics.getParticle(i);
+                if (!p->hasCollision() || p->getRadius() <= 0) continue;
+                const ofVec3f& pos = p->getPosition();
+                Body b;
+                b.x = pos.x; b.y = pos.y; b.z = pos.z;
+                b.r = p->getRadius();
+                b.w = p->isFixed() ? 0 : 1.f / max(p->getMass(), 0.0001f);
+                b.bounce = p->getBounce();
+                b.velocity = p->getVelocity();
+                bodies.push_back(b);
+                particles.push_back(p);
+                maxRadius = max(maxRadius, b.r);
+            }
+            cellSize = max(maxRadius * 2, 0.0001f);
+            invCellSize = 1.f / cellSize;
+
+            uint32_t size = 1024;
+            while (size < bodies.size() * 2) size <<= 1;
+            tableMask = size - 1;
+        }
+
+        void build(WorkerPool& pool){
+            size_t n = bodies.size();
+            size_t tableSize = tableMask + 1;
+            int parts = pool.size();
+            size_t span = (n + parts - 1) / parts;
+
+            cellOf.resize(n);
+            sorted.resize(n);
+            cellStart.assign(tableSize + 1, 0);
+            histograms.resize(parts);
+
+            // Per-range histograms
+            pool.parallelFor(parts, 1, [&](size_t begin, size_t end, int){
+                for (size_t p = begin; p < end; p++) {
+                    vector<uint32_t>& hist = histograms[p];
+                    hist.assign(tableSize, 0);
+                    size_t last = min(n, (p + 1) * span);
+                    for (size_t i = p * span; i < last; i++) {
+                        const Body& b = bodies[i];
+                        uint32_t h = hashCell(cellCoord(b.x), cellCoord(b.y), cellCoord(b.z));
+                        cellOf[i] = h;
+                        hist[h]++;
+                    }
+                }
+            });
+
+            // Cell totals, exclusive scan, then each range's base offset per cell
+            pool.parallelFor(tableSize, 4096, [&](size_t begin, size_t end, int){
+                for (size_t c = begin; c < end; c++) {
+                    uint32_t total = 0;
+                    for (int p = 0; p < parts; p++) total += histograms[p][c];
+                    cellStart[c + 1] = total;
+                }
+            });
+            for (size_t c = 0; c < tableSize; c++) cellStart[c + 1] += cellStart[c];
+            pool.parallelFor(tableSize, 4096, [&](size_t begin, size_t end, int){
+                for (size_t c = begin; c < end; c++) {
+                    uint32_t offset = cellStart[c];
+                    for (int p = 0; p < parts; p++) {
+                        uint32_t count = histograms[p][c];
+                        histograms[p][c] = offset;
+                        offset += count;
+                    }
+                }
+            });
+
+            // Stable scatter
+            pool.parallelFor(parts, 1, [&](size_t begin, size_t end, int){
+                for (size_t p = begin; p < end; p++) {
+                    vector<uint32_t>& cursor = histograms[p];
+                    size_t last = min(n, (p + 1) * span);
+                    for (size_t i = p * span; i < last; i++) {
+                        sorted[cursor[cellOf[i]]++] = i;
+                    }
+                }
+            });
+        }
+
+        void collide(WorkerPool& pool){
+            size_t n = bodies.size();
+            accumulators.resize(pool.size());
+            for (auto & acc : accumulators) {
+                if (acc.corrections.size() < n) {
+                    acc.corrections.resize(n);
+                    acc.impulses.resize(n);
+                }
+                acc.contacts = 0;
+            }
+
+            pool.parallelFor(n, 256, [&](size_t begin, size_t end, int worker){
+                Accumulator& acc = accumulators[worker];
+                uint32_t cells[27];
+                for (size_t k = begin; k < end; k++) {
+                    uint32_t i = sorted[k];
+                    const Body& a = bodies[i];
+                    int cx = cellCoord(a.x), cy = cellCoord(a.y), cz = cellCoord(a.z);
+
+                    // Neighbour cells, deduplicated since the hash can alias
+                    int numCells = 0;
+                    for (int dz = -1; dz <= 1; dz++)
+                        for (int dy = -1; dy <= 1; dy++)
+                            for (int dx = -1; dx <= 1; dx++) {
+                                uint32_t h = hashCell(cx + dx, cy + dy, cz + dz);
+                                if (find(cells, cells + numCells, h) == cells + numCells) cells[numCells++] = h;
+                            }
+
+                    for (int c = 0; c < numCells; c++) {
+                        uint32_t h = cells[c];
+                        for (uint32_t s = cellStart[h]; s < cellStart[h + 1]; s++) {
+                            uint32_t j = sorted[s];
+                            // The pair belongs to its lower index
+                            if (j <= i) continue;
+                            const Body& b = bodies[j];
+                            if (a.w + b.w == 0) continue;
+                            float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+                            float minDist = a.r + b.r;
+                            float d2 = dx*dx + dy*dy + dz*dz;
+                            if (d2 >= minDist * minDist || d2 == 0) continue;
+                            float dist = sqrt(d2);
+                            ofVec3f normal = ofVec3f(dx, dy, dz) / dist;  // from b to a
+                            float depth = minDist - dist;
+                            float share = 1.f / (a.w + b.w);
+                            acc.corrections[i] += normal * (depth * a.w * share);
+                            acc.corrections[j] -= normal * (depth * b.w * share);
+                            float approach = (a.velocity - b.velocity).dot(normal);
+                            if (approach < 0) {
+                                acc.impulses[i] -= normal * (approach * (1 + a.bounce) * a.w * share);
+                                acc.impulses[j] += normal * (approach * (1 + b.bounce) * b.w * share);
+                            }
+                            acc.contacts++;
+                        }
+                    }
+                }
+            });
+
+            contacts = 0;
+            for (auto & acc : accumulators) contacts += acc.contacts;
+        }
+
+        // Sums every worker's share per particle and moves it, leaving the
+        // accumulators zeroed for the next step
+        void apply(WorkerPool& pool){
+            pool.parallelFor(particles.size(), 1024, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    ofVec3f correction, impulse;
+                    for (auto & acc : accumulators) {
+                        if (acc.contacts == 0) continue;
+                        correction += acc.corrections[i];
+                        impulse += acc.impulses[i];
+                        acc.corrections[i] = ofVec3f();
+                        acc.impulses[i] = ofVec3f();
+                    }
+                    if (correction.x != 0 || correction.y != 0 || correction.z != 0) {
+                        particles[i]->moveBy(correction, false);
+                    }
+                    if (impulse.x != 0 || impulse.y != 0 || impulse.z != 0) {
+                        particles[i]->addVelocity(impulse);
+                    }
+                }
+            });
+        }
+
+        vector<Body>                        bodies;
+        vector<msa::physics::Particle3D*>   particles;
+        vector<uint32_t>                    cellOf, sorted, cellStart;
+        vector<vector<uint32_t>>            histograms;
+        vector<Accumulator>                 accumulators;
+        float                               cellSize, invCellSize;
+        uint32_t                            tableMask;
+        int                                 contacts;
+
+    public:
+
+        CollisionGrid(){
+            cellSize = invCellSize = 1;
+            tableMask = 1023;
+            contacts = 0;
+        }
+
+        // Resolve overlaps between collision enabled particles, call after physics.update()
+        void update(msa::physics::World3D& physics, WorkerPool& pool=WorkerPool::shared()){
+            pack(physics);
+            if (bodies.size() < 2) {
+                contacts = 0;
+                return;
+            }
+            build(pool);
+            collide(pool);
+            apply(pool);
+        }
+
+        int getContactCount() const {
+            return contacts;
+        }
+
+        float getCellSize() const {
+            return cellSize;
+        }
+    };
+}
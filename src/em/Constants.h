@@ -18,7 +18,12 @@
 #define MIN_ATTRACTION      0.0
 #define MAX_ATTRACTION      10.0
 #define LIGHT_COUNT         4
+#define MAX_SCENE_LIGHTS    512
+#define LIGHT_CLUSTER_X     16
+#define LIGHT_CLUSTER_Y     9
+#define LIGHT_CLUSTER_Z     24
 #define MAX_PARTICLES       2000
+#define MAX_BATCH_PARTICLES 50000   // world size reachable through batch construction
 
 #define	SPRING_MIN_STRENGTH		0.005
 #define SPRING_MAX_STRENGTH		0.020
@@ -26,3 +31,27 @@
 #define SPRING_MAX_LENGTH		1200
 #define SECTOR_COUNT            1
 
+#define VISIBILITY_DEPTH_BITS   24
+#define SPHERE_LOD_LEVELS       4
+#define INSTANCE_ATTRIBUTE      5       // per-instance center and radius, after OF's default attributes
+
+#define SURFACE_BLOCK_CELLS     8
+#define SURFACE_MAX_TRIANGLES   10
+
+#define XPBD_MAX_COLORS         64
+
+#define MESH_MAX_STEPS          8
+#define GOVERNOR_SMOOTHING      0.1f    // weight of the newest frame
+#define GOVERNOR_DROP_FRAMES    30      // over budget this long before dropping a step
+#define GOVERNOR_RAISE_FRAMES   120     // under the raise threshold this long before raising
+#define GOVERNOR_RAISE_HEADROOM 0.7f    // raise only below this fraction of the budget
+#define GPU_TIMER_QUERIES       4
+
+#define PICKER_LEAF_SIZE        4
+#define PICKER_REBUILD_GROWTH   2.f
+
+#define RECORDER_MAX_ENCODERS   16
+
+#define SPRING_HOT_COLOR        ofFloatColor(1.0, 0.25, 0.1)
+#define SPRING_COLD_COLOR       ofFloatColor(0.1, 0.5, 1.0)
+
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+namespace em {
+    // Records the latest value an ofParameter was set to, so expensive
+    // reactions to a change run once per frame instead of once per event.
+    template <typename T>
+    class DeferredParameter {
+
+        void onChange(T& v){
+            value = v;
+            dirty = true;
+        }
+
+        ofParameter<T>* param;
+        T               value;
+        bool            dirty;
+
+    public:
+
+        DeferredParameter(){
+            param = nullptr;
+            dirty = false;
+        }
+
+        void bind(ofParameter<T>& p){
+            unbind();
+            param = &p;
+            p.addListener(this, &DeferredParameter::onChange);
+        }
+
+        void unbind(){
+            if (param) param->removeListener(this, &DeferredParameter::onChange);
+            param = nullptr;
+        }
+
+        bool isDirty() const {
+            return dirty;
+        }
+
+        // Hands out the pending value once and clears it
+        bool consume(T& out){
+            if (!dirty) return false;
+            out = value;
+            dirty = false;
+            return true;
+        }
+    };
+}
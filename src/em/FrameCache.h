@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+namespace em {
+    // Decides whether the scene fbo has to be rendered again or the last
+    // frame can be presented as is. A frame is rendered when something
+    // animates on its own, the camera moved, the scene revision changed or
+    // one of the watched parameters was touched.
+    class FrameCache {
+
+        void onWatchedChange(bool& v){
+            bDirty = true;
+        }
+
+        vector<ofParameter<bool>*>  watched;
+        ofMatrix4x4                 lastView;
+        float                       lastFov, lastNear, lastFar;
+        uint64_t                    lastRevision;
+        bool                        bDirty;
+
+    public:
+
+        FrameCache(){
+            lastFov = lastNear = lastFar = 0;
+            lastRevision = 0;
+            bDirty = true;
+        }
+
+        ~FrameCache(){
+            for (auto p : watched) p->removeListener(this, &FrameCache::onWatchedChange);
+        }
+
+        void setup(){
+            params.setName("Frame cache");
+            params.add(enabled.set("Skip idle frames", true));
+            params.add(skippedFrames.set("Skipped frames", 0));
+        }
+
+        // Draw toggles that live outside the tracked parameter groups
+        void watch(ofParameter<bool>& p){
+            p.addListener(this, &FrameCache::onWatchedChange);
+            watched.push_back(&p);
+        }
+
+        void invalidate(){
+            bDirty = true;
+        }
+
+        // Call once per frame before rendering, false means reuse the last frame
+        bool needsRedraw(const ofCamera& cam, uint64_t revision, bool animating){
+            ofMatrix4x4 view = cam.getModelViewMatrix();
+            bool moved = view != lastView
+                || cam.getFov() != lastFov
+                || cam.getNearClip() != lastNear
+                || cam.getFarClip() != lastFar;
+            bool redraw = !enabled || bDirty || animating || moved || revision != lastRevision;
+
+            lastView = view;
+            lastFov = cam.getFov();
+            lastNear = cam.getNearClip();
+            lastFar = cam.getFarClip();
+            lastRevision = revision;
+            bDirty = false;
+            if (!redraw) skippedFrames.set(skippedFrames + 1);
+            return redraw;
+        }
+
+        ofParameterGroup    params;
+        ofParameter<bool>   enabled;
+        ofParameter<int>    skippedFrames;
+    };
+}
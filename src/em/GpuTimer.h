@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Constants.h"
+
+
+namespace em {
+    // GPU time of a span of GL commands from timer queries. Results are
+    // read a few frames late from a ring of queries, so asking for them
+    // never stalls the pipeline. Begin/end pairs must not nest.
+    class GpuTimer {
+
+        // Oldest query first, stops at the first one the GPU hasn't finished
+        void collect(){
+            for (int i = 0; i < GPU_TIMER_QUERIES; i++) {
+                int slot = (frame + i) % GPU_TIMER_QUERIES;
+                if (!pending[slot]) continue;
+                GLint available = 0;
+                glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) break;
+                GLuint64 nanos = 0;
+                glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &nanos);
+                millis = nanos / 1e6f;
+                pending[slot] = false;
+            }
+        }
+
+        GLuint  queries[GPU_TIMER_QUERIES];
+        bool    pending[GPU_TIMER_QUERIES];
+        int     frame;
+        float   millis;
+        bool    bSetup;
+
+    public:
+
+        GpuTimer(){
+            frame = 0;
+            millis = 0;
+            bSetup = false;
+            for (int i = 0; i < GPU_TIMER_QUERIES; i++) pending[i] = false;
+        }
+
+        ~GpuTimer(){
+            if (bSetup) glDeleteQueries(GPU_TIMER_QUERIES, queries);
+        }
+
+        void begin(){
+            if (!bSetup) {
+                glGenQueries(GPU_TIMER_QUERIES, queries);
+                bSetup = true;
+            }
+            collect();
+            glBeginQuery(GL_TIME_ELAPSED, queries[frame % GPU_TIMER_QUERIES]);
+        }
+
+        void end(){
+            glEndQuery(GL_TIME_ELAPSED);
+            pending[frame % GPU_TIMER_QUERIES] = true;
+            frame++;
+        }
+
+        // Latest finished measurement, a few frames behind
+        float getMillis() const {
+            return millis;
+        }
+    };
+}
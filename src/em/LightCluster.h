@@ -0,0 +1,163 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Constants.h"
+
+
+namespace em {
+    // CPU side clustered light assignment. The view frustum is split into
+    // a tilesX * tilesY screen grid and slicesZ exponential depth slices,
+    // every light sphere (in camera space, looking down -Z) is binned into
+    // the clusters it touches. Plain math only, no GL state is touched.
+    class LightCluster {
+
+        struct Range {
+            int x0, x1, y0, y1, z0, z1;
+        };
+
+        int sliceForDepth(float depth) const {
+            if (depth <= nearClip) return 0;
+            int s = floor(log(depth / nearClip) * sliceScale);
+            return ofClamp(s, 0, slicesZ - 1);
+        }
+
+        int tileForNdc(float ndc, int tiles) const {
+            int t = floor((ndc * 0.5f + 0.5f) * tiles);
+            return ofClamp(t, 0, tiles - 1);
+        }
+
+        // Conservative NDC extent of [lo, hi] seen at depths [zNear, zFar]
+        void projectExtent(float lo, float hi, float zNear, float zFar, float tanHalf,
+                           float& ndcLo, float& ndcHi) const {
+            ndcLo = lo / ((lo < 0 ? zNear : zFar) * tanHalf);
+            ndcHi = hi / ((hi > 0 ? zNear : zFar) * tanHalf);
+        }
+
+        int     tilesX, tilesY, slicesZ;
+        float   nearClip, farClip;
+        float   sliceScale;
+
+        vector<Range>           ranges;
+        vector<unsigned int>    grid;       // offset, count per cluster
+        vector<unsigned int>    indices;
+        vector<unsigned int>    cursor;
+
+    public:
+
+        LightCluster(){
+            setup(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y, LIGHT_CLUSTER_Z);
+        }
+
+        void setup(int x, int y, int z){
+            tilesX = max(x, 1);
+            tilesY = max(y, 1);
+            slicesZ = max(z, 1);
+            nearClip = 0.1f;
+            farClip = 1000.f;
+            sliceScale = 1.f;
+            grid.assign(getClusterCount() * 2, 0);
+            indices.clear();
+        }
+
+        // fov is the vertical field of view in degrees, as in ofCamera
+        void assign(const vector<ofVec3f>& viewPositions, const vector<float>& radii,
+                    float fov, float aspect, float nearC, float farC){
+            nearClip = max(nearC, 0.0001f);
+            farClip = max(farC, nearClip * 1.0001f);
+            sliceScale = slicesZ / log(farClip / nearClip);
+
+            float tanY = tan(fov * 0.5f * DEG_TO_RAD);
+            float tanX = tanY * aspect;
+
+            size_t numLights = min(viewPositions.size(), radii.size());
+            size_t numClusters = getClusterCount();
+            ranges.resize(numLights);
+            grid.assign(numClusters * 2, 0);
+
+            // Pass 1: cluster ranges and counts
+            size_t total = 0;
+            for (size_t i = 0; i < numLights; i++) {
+                const ofVec3f& p = viewPositions[i];
+                float r = radii[i];
+                float depth = -p.z;
+                Range& range = ranges[i];
+
+                if (r <= 0 || depth + r < nearClip || depth - r > farClip) {
+                    range.x0 = 1; range.x1 = 0;
+                    continue;
+                }
+                float zNear = max(depth - r, nearClip);
+                float zFar = min(depth + r, farClip);
+
+                float xLo, xHi, yLo, yHi;
+                projectExtent(p.x - r, p.x + r, zNear, zFar, tanX, xLo, xHi);
+                projectExtent(p.y - r, p.y + r, zNear, zFar, tanY, yLo, yHi);
+                if (xHi < -1 || xLo > 1 || yHi < -1 || yLo > 1) {
+                    range.x0 = 1; range.x1 = 0;
+                    continue;
+                }
+
+                range.x0 = tileForNdc(xLo, tilesX);
+                range.x1 = tileForNdc(xHi, tilesX);
+                range.y0 = tileForNdc(yLo, tilesY);
+                range.y1 = tileForNdc(yHi, tilesY);
+                range.z0 = sliceForDepth(zNear);
+                range.z1 = sliceForDepth(zFar);
+
+                for (int z = range.z0; z <= range.z1; z++)
+                    for (int y = range.y0; y <= range.y1; y++)
+                        for (int x = range.x0; x <= range.x1; x++)
+                            grid[getClusterIndex(x, y, z) * 2 + 1]++;
+                total += (range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1) * (range.z1 - range.z0 + 1);
+            }
+
+            // Prefix sum into offsets
+            unsigned int offset = 0;
+            cursor.resize(numClusters);
+            for (size_t c = 0; c < numClusters; c++) {
+                grid[c * 2] = offset;
+                cursor[c] = offset;
+                offset += grid[c * 2 + 1];
+            }
+
+            // Pass 2: scatter light indices
+            indices.resize(total);
+            for (size_t i = 0; i < numLights; i++) {
+                const Range& range = ranges[i];
+                if (range.x0 > range.x1) continue;
+                for (int z = range.z0; z <= range.z1; z++)
+                    for (int y = range.y0; y <= range.y1; y++)
+                        for (int x = range.x0; x <= range.x1; x++)
+                            indices[cursor[getClusterIndex(x, y, z)]++] = i;
+            }
+        }
+
+        int getClusterIndex(int x, int y, int z) const {
+            return (z * tilesY + y) * tilesX + x;
+        }
+
+        // Cluster holding a camera space point, -1 when outside the frustum
+        int findCluster(const ofVec3f& viewPosition, float fov, float aspect) const {
+            float depth = -viewPosition.z;
+            if (depth < nearClip || depth > farClip) return -1;
+            float tanY = tan(fov * 0.5f * DEG_TO_RAD);
+            float ndcX = viewPosition.x / (depth * tanY * aspect);
+            float ndcY = viewPosition.y / (depth * tanY);
+            if (fabs(ndcX) > 1 || fabs(ndcY) > 1) return -1;
+            return getClusterIndex(tileForNdc(ndcX, tilesX), tileForNdc(ndcY, tilesY), sliceForDepth(depth));
+        }
+
+        unsigned int getOffset(int cluster) const { return grid[cluster * 2]; }
+        unsigned int getCount(int cluster) const { return grid[cluster * 2 + 1]; }
+
+        size_t getClusterCount() const { return tilesX * tilesY * slicesZ; }
+        int getTilesX() const { return tilesX; }
+        int getTilesY() const { return tilesY; }
+        int getSlicesZ() const { return slicesZ; }
+        float getSliceScale() const { return sliceScale; }
+        float getNearClip() const { return nearClip; }
+
+        const vector<unsigned int>& getGrid() const { return grid; }
+        const vector<unsigned int>& getIndices() const { return indices; }
+    };
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include "ofMain.h"
+#include "SceneLight.h"
+#include "LightCluster.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Owns the scene lights. The first LIGHT_COUNT are the fixed function
+    // SceneLights, the rest are lightweight orbiting point lights. All of
+    // them are packed into one buffer texture and shaded through a
+    // clustered light list built on the CPU every frame.
+    class LightManager {
+
+        struct OrbitLight {
+            float phase, speed, tilt;
+            ofFloatColor color;
+        };
+
+        // Two RGBA32F texels per light: view position + radius, color + intensity
+        struct PackedLight {
+            ofVec4f positionRadius;
+            ofVec4f colorIntensity;
+
+            bool operator==(const PackedLight& o) const {
+                return memcmp(this, &o, sizeof(PackedLight)) == 0;
+            }
+        };
+
+        void setupShader(){
+            string vert = R"(#version 410
+                uniform mat4 modelViewMatrix;
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+                in vec3 normal;
+                in vec4 instance;
+                out vec3 vViewPosition;
+                out vec3 vViewNormal;
+                void main(){
+                    // Without an instance array the attribute reads (0, 0, 0, 1)
+                    vec4 local = vec4(instance.xyz + position.xyz * instance.w, position.w);
+                    vViewPosition = (modelViewMatrix * local).xyz;
+                    vViewNormal = mat3(modelViewMatrix) * normal;
+                    gl_Position = modelViewProjectionMatrix * local;
+                }
+            )";
+            string frag = R"(#version 410
+                uniform samplerBuffer lightData;
+                uniform usamplerBuffer clusterGrid;
+                uniform usamplerBuffer clusterIndices;
+                uniform ivec3 clusterDims;
+                uniform vec2 tanHalfFov;
+                uniform float nearClip;
+                uniform float sliceScale;
+                uniform vec4 ambientColor;
+                uniform vec4 diffuseColor;
+                in vec3 vViewPosition;
+                in vec3 vViewNormal;
+                out vec4 fragColor;
+                void main(){
+                    float depth = -vViewPosition.z;
+                    vec2 ndc = vViewPosition.xy / (depth * tanHalfFov);
+                    ivec2 tile = clamp(ivec2(floor((ndc * 0.5 + 0.5) * vec2(clusterDims.xy))), ivec2(0), clusterDims.xy - 1);
+                    int slice = clamp(int(floor(log(max(depth, nearClip) / nearClip) * sliceScale)), 0, clusterDims.z - 1);
+                    int cluster = (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x;
+                    uvec2 entry = texelFetch(clusterGrid, cluster).xy;
+
+                    vec3 n = length(vViewNormal) > 0.0 ? normalize(vViewNormal) : vec3(0.0, 0.0, 1.0);
+                    vec3 lit = ambientColor.rgb;
+                    for (uint i = 0u; i < entry.y; i++) {
+                        int index = int(texelFetch(clusterIndices, int(entry.x + i)).r);
+                        vec4 pr = texelFetch(lightData, index * 2);
+                        vec4 ci = texelFetch(lightData, index * 2 + 1);
+                        vec3 toLight = pr.xyz - vViewPosition;
+                        float dist = length(toLight);
+                        float falloff = clamp(1.0 - dist / pr.w, 0.0, 1.0);
+                        lit += ci.rgb * ci.a * falloff * falloff * max(dot(n, toLight / dist), 0.0);
+                    }
+                    fragColor = vec4(diffuseColor.rgb * lit, diffuseColor.a);
+                }
+            )";
+            shader.setupShaderFromSource(GL_VERTEX_SHADER, vert);
+            shader.setupShaderFromSource(GL_FRAGMENT_SHADER, frag);
+            shader.bindDefaults();
+            shader.bindAttribute(INSTANCE_ATTRIBUTE, "instance");
+            shader.linkProgram();
+        }
+
+        void setupBuffers(){
+            lightBuffer.allocate(MAX_SCENE_LIGHTS * sizeof(PackedLight), GL_DYNAMIC_DRAW);
+            lightTex.allocateAsBufferTexture(lightBuffer, GL_RGBA32F);
+            gridBuffer.allocate(cluster.getGrid().size() * sizeof(unsigned int), GL_STREAM_DRAW);
+            gridTex.allocateAsBufferTexture(gridBuffer, GL_RG32UI);
+            indexCapacity = 0;
+            reserveIndices(MAX_SCENE_LIGHTS * 4);
+        }
+
+        void reserveIndices(size_t count){
+            if (count <= indexCapacity) return;
+            indexCapacity = max(count, indexCapacity * 2);
+            indexBuffer.allocate(indexCapacity * sizeof(unsigned int), GL_STREAM_DRAW);
+            indexTex.allocateAsBufferTexture(indexBuffer, GL_R32UI);
+        }
+
+        void setOrbitLightCount(int& n){
+            int count = ofClamp(n, 0, MAX_SCENE_LIGHTS - LIGHT_COUNT);
+            while ((int)orbitLights.size() < count) {
+                OrbitLight l;
+                l.phase = ofRandom(TWO_PI);
+                l.speed = ofRandom(0.2f, 1.f);
+                l.tilt = ofRandom(-1.f, 1.f);
+                l.color = ofFloatColor(ofRandom(0.3f, 1.f), ofRandom(0.3f, 1.f), ofRandom(0.3f, 1.f));
+                orbitLights.push_back(l);
+            }
+            orbitLights.resize(count);
+        }
+
+        PackedLight pack(const ofPoint& worldPos, float radius, const ofFloatColor& color, float intensity) const {
+            ofVec3f p = worldPos * viewMatrix;
+            PackedLight packed;
+            packed.positionRadius = ofVec4f(p.x, p.y, p.z, radius);
+            packed.colorIntensity = ofVec4f(color.r, color.g, color.b, intensity);
+            return packed;
+        }
+
+        // Re-pack every light and upload only the span that changed
+        void uploadLights(){
+            size_t count = LIGHT_COUNT + activeOrbitLights;
+            packed.resize(count);
+
+            size_t dirtyBegin = count, dirtyEnd = 0;
+            for (size_t i = 0; i < count; i++) {
+                PackedLight l;
+                if (i < lights.size()) {
+                    SceneLight& light = lights[i];
+                    l = pack(light.getPosition(), light.isOn() ? boxSize * 2 : 0, light.diffuse, 1.f);
+                } else if (i >= LIGHT_COUNT) {
+                    const OrbitLight& o = orbitLights[i - LIGHT_COUNT];
+                    float t = time * o.speed + o.phase;
+                    float r = boxSize * orbitRadius;
+                    ofPoint pos(cos(t) * r, sin(t * 0.5f) * o.tilt * r, sin(t) * r);
+                    l = pack(pos, orbitLightRange, o.color, orbitLightIntensity);
+                } else {
+                    l = pack(ofPoint(), 0, ofFloatColor(0,0,0), 0);
+                }
+                if (i >= uploadedCount || !(l == packed[i])) {
+                    packed[i] = l;
+                    dirtyBegin = min(dirtyBegin, i);
+                    dirtyEnd = i + 1;
+                }
+            }
+            uploadedCount = count;
+
+            if (dirtyBegin < dirtyEnd) {
+                lightBuffer.updateData(dirtyBegin * sizeof(PackedLight),
+                                       (dirtyEnd - dirtyBegin) * sizeof(PackedLight),
+                                       &packed[dirtyBegin]);
+                bytesUploaded += (dirtyEnd - dirtyBegin) * sizeof(PackedLight);
+            }
+        }
+
+        void uploadClusters(const ofCamera& cam){
+            viewPositions.resize(packed.size());
+            radii.resize(packed.size());
+            for (size_t i = 0; i < packed.size(); i++) {
+                const ofVec4f& pr = packed[i].positionRadius;
+                viewPositions[i].set(pr.x, pr.y, pr.z);
+                radii[i] = pr.w;
+            }
+            cluster.assign(viewPositions, radii, cam.getFov(), FBO_WIDTH / (float) FBO_HEIGHT,
+                           cam.getNearClip(), cam.getFarClip());
+
+            const vector<unsigned int>& grid = cluster.getGrid();
+            const vector<unsigned int>& indices = cluster.getIndices();
+            gridBuffer.updateData(0, grid.size() * sizeof(unsigned int), &grid[0]);
+            if (!indices.empty()) {
+                reserveIndices(indices.size());
+                indexBuffer.updateData(0, indices.size() * sizeof(unsigned int), &indices[0]);
+            }
+            clusterEntries.set(indices.size());
+        }
+
+        vector<OrbitLight>      orbitLights;
+        vector<PackedLight>     packed;
+        size_t                  uploadedCount;
+        size_t                  indexCapacity;
+        size_t                  bytesUploaded;
+        vector<ofVec3f>         viewPositions;
+        vector<float>           radii;
+        ofMatrix4x4             viewMatrix;
+        float                   boxSize, time, fov;
+        float                   lightScale;
+        int                     activeOrbitLights;
+
+        LightCluster            cluster;
+        ofBufferObject          lightBuffer, gridBuffer, indexBuffer;
+        ofTexture               lightTex, gridTex, indexTex;
+        ofShader                shader;
+
+    public:
+
+        LightManager(){
+            uploadedCount = 0;
+            indexCapacity = 0;
+            bytesUploaded = 0;
+            boxSize = 0;
+            time = 0;
+            fov = 60;
+            lightScale = 1;
+            activeOrbitLights = 0;
+        }
+
+        ~LightManager(){
+            orbitLightCount.removeListener(this, &LightManager::setOrbitLightCount);
+        }
+
+        void setup(){
+            for (int i=0; i<LIGHT_COUNT; i++){
+                SceneLight light;
+                light.setup(i);
+                lights.push_back(light);
+            }
+
+            params.setName("Lights");
+            params.add(globalAmbient.set("Global ambient", ofFloatColor(.1,.1,.1), ofFloatColor(0,0,0), ofFloatColor(1,1,1)));
+            params.add(clustered.set("Clustered shading", false));
+            params.add(orbitLightCount.set("Orbit lights", 0, 0, MAX_SCENE_LIGHTS - LIGHT_COUNT));
+            params.add(orbitLightRange.set("Orbit light range", 200, 10, 2000));
+            params.add(orbitLightIntensity.set("Orbit light intensity", 1, 0, 4));
+            params.add(orbitRadius.set("Orbit radius", 1.0, 0.1, 2.0));
+            for (auto & light : lights) {
+                params.add(light.params);
+            }
+            stats.setName("Stats");
+            stats.add(clusterEntries.set("Cluster entries", 0));
+            params.add(stats);
+            orbitLightCount.addListener(this, &LightManager::setOrbitLightCount);
+
+            setupBuffers();
+            setupShader();
+        }
+
+        void update(const float& bs, const ofCamera& cam){
+            boxSize = bs;
+            time = ofGetElapsedTimef();
+            
+            // Keep the first lights within the scaled budget, suspend the rest
+            int budget = getEnabledLightCount();
+            if (lightScale < 1) budget = max((int) ceil(budget * lightScale), 1);
+            for (auto & light : lights) {
+                light.setSuspended(light.enabled && budget <= 0);
+                if (light.enabled && budget > 0) budget--;
+            }
+            activeOrbitLights = min((int) orbitLights.size(), budget);
+            for (auto & light : lights) {
+                light.update(boxSize);
+            }
+            if (clustered) {
+                viewMatrix = cam.getModelViewMatrix();
+                fov = cam.getFov();
+                uploadLights();
+                uploadClusters(cam);
+            } else {
+                uploadedCount = 0;
+            }
+        }
+
+        // Lights switched on in the settings, orbit lights only count when clustered
+        int getEnabledLightCount() const {
+            int count = clustered ? orbitLights.size() : 0;
+            for (auto & light : lights) {
+                if (light.enabled) count++;
+            }
+            return count;
+        }
+        
+        // Fraction of the enabled lights actually used, at least one stays on
+        void setLightScale(float scale){
+            lightScale = ofClamp(scale, 0, 1);
+        }
+        
+        // True while any light moves on its own
+        bool isAnimating() const {
+            for (auto & light : lights) {
+                if (light.enabled && light.orbit) return true;
+            }
+            return clustered && orbitLightCount > 0;
+        }
+
+        void draw(){
+            for (auto & light : lights) {
+                light.draw();
+            }
+        }
+
+        // Bind the clustered shader around geometry drawn inside the camera
+        void begin(const ofFloatColor& diffuse){
+            if (!clustered) return;
+            float tanY = tan(fov * 0.5f * DEG_TO_RAD);
+            shader.begin();
+            shader.setUniformTexture("lightData", lightTex, 1);
+            shader.setUniformTexture("clusterGrid", gridTex, 2);
+            shader.setUniformTexture("clusterIndices", indexTex, 3);
+            shader.setUniform3i("clusterDims", cluster.getTilesX(), cluster.getTilesY(), cluster.getSlicesZ());
+            shader.setUniform2f("tanHalfFov", tanY * FBO_WIDTH / (float) FBO_HEIGHT, tanY);
+            shader.setUniform1f("nearClip", cluster.getNearClip());
+            shader.setUniform1f("sliceScale", cluster.getSliceScale());
+            const ofFloatColor& a = globalAmbient.get();
+            shader.setUniform4f("ambientColor", a.r, a.g, a.b, a.a);
+            shader.setUniform4f("diffuseColor", diffuse.r, diffuse.g, diffuse.b, diffuse.a);
+        }
+
+        void end(){
+            if (clustered) shader.end();
+        }
+
+        void randomiseAmbientColor(){
+            for (auto & light : lights){
+                light.randomiseAmbientColor();
+            }
+        }
+
+        size_t getBytesUploaded() const {
+            return bytesUploaded;
+        }
+
+        const LightCluster& getCluster() const {
+            return cluster;
+        }
+
+        vector<SceneLight>          lights;
+
+        ofParameterGroup            params;
+        ofParameterGroup            stats;
+        ofParameter<ofFloatColor>   globalAmbient;
+        ofParameter<bool>           clustered;
+        ofParameter<int>            orbitLightCount;
+        ofParameter<float>          orbitLightRange;
+        ofParameter<float>          orbitLightIntensity;
+        ofParameter<float>          orbitRadius;
+        ofParameter<int>            clusterEntries;
+    };
+}
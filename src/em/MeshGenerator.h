@@ -3,6 +3,17 @@
 #include "ofMain.h"
 #include "MSAPhysics3D.h"
 #include "ofxAnimatableOfPoint.h"
+#include "DeferredParameter.h"
+#include "SpringTension.h"
+#include "ParticleEmitter.h"
+#include "CollisionGrid.h"
+#include "ClusterBuilder.h"
+#include "SphereLod.h"
+#include "VisibilityStage.h"
+#include "ParticlePicker.h"
+#include "SurfaceMesher.h"
+#include "XpbdSolver.h"
+#include "SimulationThread.h"
 #include "Constants.h"
 
 
@@ -11,6 +22,22 @@ namespace em {
         
     private:
         
+        // Everything the step reads, copied from the parameters on the main
+        // thread before it starts so gui edits, preset morphs and the
+        // governor never write what the simulation thread is reading
+        struct StepSettings {
+            bool                        paused;
+            int                         steps;
+            float                       frameTime;
+            bool                        collisions;
+            bool                        visualizeTension;
+            float                       tensionGain, tensionWidth;
+            ofFloatColor                polyColor, springColor;
+            ParticleEmitter::Settings   emitter;
+            XpbdSolver::Settings        xpbd;
+            SurfaceMesher::Settings     surface;
+        };
+        
         void updateShading(){
             polyMat.setAmbientColor(polygonAmbient);
             polyMat.setDiffuseColor(polygonDiffuse);
@@ -23,78 +50,253 @@ namespace em {
             springMat.setShininess(springShininess);
         }
         
+        // One simulation step. With threaded physics it runs on the
+        // simulation thread while the previous frame is drawn, so it reads
+        // settings from `step` only and writes nothing but the back buffers.
         void updatePhysics(){
-            int numParticles = physics.numberOfParticles();
-            int numSprings = physics.numberOfSprings();
-            int numAttractions = physics.numberOfAttractions();
-            
+            uint64_t stepStart = ofGetElapsedTimeMicros();
             float dt = 1.0f / 60.0f;
             fixedParticlePos.update(dt);
             fixedParticle.moveTo(fixedParticlePos.getCurrentPosition());
-            particleCount.set(numParticles);
-            springCount.set(numSprings);
-            attractionCount.set(numAttractions);
             
-            if (!physicsPaused) {
-                physics.update();
+            if (!step.paused) {
+                emitter.update(physics, fixedParticle, step.emitter, step.frameTime);
+                for (int i = 0; i < step.steps; i++) {
+                    // Springs as constraints solved after MSA integrates
+                    if (step.xpbd.enabled)              xpbd.prepare(physics, step.xpbd);
+                    else if (xpbd.isHoldingSprings())   xpbd.release();
+                    physics.update();
+                    if (step.xpbd.enabled)              xpbd.solve(physics, step.xpbd, dt);
+                    // MSA's own collision is brute force, resolve through the hash grid instead
+                    if (step.collisions) collisionGrid.update(physics);
+                }
+                backChanged = true;
             }
+            picker.update(physics);
             
-            polyMesh.clear();
-            polyMesh.setMode(OF_PRIMITIVE_TRIANGLE_FAN);
+            // Particle snapshot for sphere drawing
+            int numParticles = physics.numberOfParticles();
+            backPositions.resize(numParticles);
+            backRadii.resize(numParticles);
             for(int i=0; i<numParticles; i++){
                 auto p = physics.getParticle(i);
-                polyMesh.addVertex(p->getPosition());
-                polyMesh.addColor(polyMat.getDiffuseColor());
+                backPositions[i] = p->getPosition();
+                backRadii[i] = p->getRadius();
             }
             
-            springMesh.clear();
-            springMesh.setMode(OF_PRIMITIVE_LINES);
-            for(int i=0; i<physics.numberOfSprings(); i++){
+            if (step.surface.enabled) {
+                // Only blocks whose particles moved are rebuilt, the mesh is left alone otherwise
+                if (surface.update(physics, step.surface, backPolyMesh, step.polyColor)) {
+                    backPolyChanged = backChanged = true;
+                }
+            } else {
+                surface.clear();
+                backPolyMesh.clear();
+                backPolyMesh.setMode(OF_PRIMITIVE_TRIANGLE_FAN);
+                for(int i=0; i<numParticles; i++){
+                    if (backRadii[i] <= 0) continue;
+                    backPolyMesh.addVertex(backPositions[i]);
+                    backPolyMesh.addColor(step.polyColor);
+                }
+                backPolyChanged = true;
+            }
+            
+            // Gather spring endpoints into the line vertex stream and, when
+            // tension is shown, the packed tension arrays in the same walk
+            int numSprings = physics.numberOfSprings();
+            bool tension = step.visualizeTension;
+            if (tension) springTension.resize(numSprings);
+            vector<ofVec3f>& springVerts = backSpringMesh.getVertices();
+            springVerts.resize(numSprings * 2);
+            int numActive = 0;
+            for(int i=0; i<numSprings; i++){
                 auto spring = (msa::physics::Spring3D *) physics.getSpring(i);
-                auto a = spring->getOneEnd();
-                auto b = spring->getTheOtherEnd();
-                ofVec3f vec = b->getPosition() - a->getPosition();
-                float dist = vec.length();
-                float angle = acos( vec.z / dist ) * RAD_TO_DEG;
-                if(vec.z <= 0 ) angle = -angle;
-                float rx = -vec.y * vec.z;
-                float ry =  vec.x * vec.z;
-                
-                float size = ofMap(spring->getStrength(), SPRING_MIN_STRENGTH, SPRING_MAX_STRENGTH, SPRING_MIN_LENGTH, SPRING_MAX_LENGTH);
-                
-                springMesh.addVertex(a->getPosition());
-                springMesh.addColor(springMat.getDiffuseColor());
-                springMesh.addVertex(b->getPosition());
-                springMesh.addColor(springMat.getDiffuseColor());
+                if (!spring->isOn()) continue;
+                const ofVec3f& a = spring->getOneEnd()->getPosition();
+                const ofVec3f& b = spring->getTheOtherEnd()->getPosition();
+                springVerts[numActive*2] = a;
+                springVerts[numActive*2+1] = b;
+                if (tension) springTension.set(numActive, a, b, spring->getRestLength());
+                numActive++;
+            }
+            numSprings = numActive;
+            springVerts.resize(numSprings * 2);
+            if (tension) springTension.resize(numSprings);
+            
+            vector<ofFloatColor>& springColors = backSpringMesh.getColors();
+            springColors.resize(numSprings * 2);
+            if (tension) {
+                springTension.compute(step.springColor, SPRING_HOT_COLOR, SPRING_COLD_COLOR, step.tensionGain, step.tensionWidth);
+                vector<ofVec2f>& springAttribs = backSpringMesh.getTexCoords();
+                springAttribs.resize(numSprings * 2);
+                for(int i=0; i<numSprings; i++){
+                    ofFloatColor c = springTension.getColor(i, step.springColor.a);
+                    ofVec2f attrib(springTension.getWidth(i), springTension.getTension(i));
+                    springColors[i*2] = springColors[i*2+1] = c;
+                    springAttribs[i*2] = springAttribs[i*2+1] = attrib;
+                }
+            } else {
+                fill(springColors.begin(), springColors.end(), step.springColor);
+                backSpringMesh.getTexCoords().clear();
             }
+            stepMillis = (ofGetElapsedTimeMicros() - stepStart) / 1000.f;
+            backReady = true;
         }
         
-        void setZDepth(float& v) {
-            for (int i=0; i<physics.numberOfParticles(); i++) {
-                auto p = physics.getParticle(i);
-                ofPoint pos(p->getPosition());
-                pos.z = ofRandom(-v, v);
-                p->moveTo(pos);
+        // Hands the last step over to drawing. Runs on the main thread
+        // while the simulation thread is idle, so it may touch parameters.
+        void publishFrame(){
+            int numParticles = physics.numberOfParticles();
+            int numSprings = physics.numberOfSprings();
+            particleCount.set(numParticles);
+            springCount.set(numSprings);
+            attractionCount.set(physics.numberOfAttractions());
+            contactCount.set(collisions ? collisionGrid.getContactCount() : 0);
+            physicsTime.set(stepMillis);
+            emitter.publishStats();
+            xpbd.publishStats();
+            surface.publishStats();
+            
+            hoverRadius = hovered && isVisible(hovered) ? hovered->getRadius() : 0;
+            if (hoverRadius > 0) {
+                hoverPosition = hovered->getPosition();
+                hoverFixed = hovered->isFixed();
             }
+            
+            if (!backReady) return;
+            backReady = false;
+            // Only now is the change drawn, bumping earlier would let the
+            // frame cache skip the frame that shows it
+            if (backChanged) revision++;
+            backChanged = false;
+            // The surface mesh is updated in place block by block, so it is
+            // copied; everything else is rewritten each step and swapped
+            if (backPolyChanged) {
+                polyMesh.setMode(backPolyMesh.getMode());
+                polyMesh.getVertices() = backPolyMesh.getVertices();
+                polyMesh.getNormals() = backPolyMesh.getNormals();
+                polyMesh.getColors() = backPolyMesh.getColors();
+                polyMesh.getIndices() = backPolyMesh.getIndices();
+                backPolyChanged = false;
+            }
+            springMesh.setMode(OF_PRIMITIVE_LINES);
+            springMesh.getVertices().swap(backSpringMesh.getVertices());
+            springMesh.getColors().swap(backSpringMesh.getColors());
+            springMesh.getTexCoords().swap(backSpringMesh.getTexCoords());
+            particlePositions.swap(backPositions);
+            particleRadii.swap(backRadii);
         }
-        void setGravityVec(ofPoint& g){
-            physics.setGravity(g);
+        
+        // Expands spring lines into screen space quads whose width comes from
+        // the per-vertex tension attribute (stored in the texcoord stream)
+        void setupSpringShader(){
+            string vert = R"(#version 410
+                uniform mat4 modelViewProjectionMatrix;
+                in vec4 position;
+                in vec4 color;
+                in vec2 texcoord;
+                out vec4 vColor;
+                out float vWidth;
+                void main(){
+                    vColor = color;
+                    vWidth = texcoord.x;
+                    gl_Position = modelViewProjectionMatrix * position;
+                }
+            )";
+            string geom = R"(#version 410
+                layout(lines) in;
+                layout(triangle_strip, max_vertices = 4) out;
+                uniform vec2 viewport;
+                in vec4 vColor[];
+                in float vWidth[];
+                out vec4 gColor;
+                void main(){
+                    vec4 p0 = gl_in[0].gl_Position;
+                    vec4 p1 = gl_in[1].gl_Position;
+                    vec2 dir = normalize((p1.xy / p1.w - p0.xy / p0.w) * viewport);
+                    vec2 offset = vec2(-dir.y, dir.x) / viewport;
+                    vec2 o0 = offset * vWidth[0] * p0.w;
+                    vec2 o1 = offset * vWidth[1] * p1.w;
+                    gColor = vColor[0];
+                    gl_Position = vec4(p0.xy + o0, p0.zw); EmitVertex();
+                    gl_Position = vec4(p0.xy - o0, p0.zw); EmitVertex();
+                    gColor = vColor[1];
+                    gl_Position = vec4(p1.xy + o1, p1.zw); EmitVertex();
+                    gl_Position = vec4(p1.xy - o1, p1.zw); EmitVertex();
+                    EndPrimitive();
+                }
+            )";
+            string frag = R"(#version 410
+                in vec4 gColor;
+                out vec4 fragColor;
+                void main(){
+                    fragColor = gColor;
+                }
+            )";
+            springShader.setupShaderFromSource(GL_VERTEX_SHADER, vert);
+            springShader.setupShaderFromSource(GL_GEOMETRY_SHADER, geom);
+            springShader.setupShaderFromSource(GL_FRAGMENT_SHADER, frag);
+            springShader.bindDefaults();
+            springShader.linkProgram();
         }
+        
+        // Particles parked by the emitter keep their slot but have no radius
         template <typename T>
-        void makeSpringBetweenParticles(msa::physics::ParticleT<T> *a,
-                                        msa::physics::ParticleT<T> *b){
-            float dist = a->getPosition().distance(b->getPosition());
-            float strength = dist*springStrength;
-            bool springExists = false;
-            for (int i=0; i<physics.numberOfSprings(); i++) {
-                auto s = physics.getSpring(i);
-                if ((s->getOneEnd() == a || s->getTheOtherEnd() == a) &&
-                    (s->getOneEnd() == b || s->getTheOtherEnd() == b)) {
-                    springExists = true;
-                    return;
-                }
+        bool isVisible(msa::physics::ParticleT<T> *p) const {
+            return p->getRadius() > 0;
+        }
+        
+        // Apply the latest value of every parameter that changed since last
+        // frame and take the step's copy of the rest
+        void applyPendingParams(){
+            double s;
+            ofPoint g;
+            float z;
+            if (pendingBoxSize.consume(s))  setPhysicsBoxSize(s);
+            if (pendingGravity.consume(g))  setGravityVec(g);
+            if (pendingZDepth.consume(z)) setZDepth(z);
+            
+            // Inputs that change the drawn meshes even when nothing moves
+            if (step.visualizeTension != visualizeTension.get() || step.tensionGain != tensionGain.get()
+                || step.tensionWidth != tensionWidth.get() || step.polyColor != polygonDiffuse.get()
+                || step.springColor != springDiffuse.get() || step.surface.enabled != surface.enabled.get()) {
+                markChanged();
             }
-            if (!springExists) physics.makeSpring(a, b, springStrength, springLength);
+            step.paused = physicsPaused;
+            step.steps = min((int) stepsPerFrame, stepLimit);
+            step.frameTime = min(ofGetLastFrameTime(), 0.1);
+            step.collisions = collisions;
+            step.visualizeTension = visualizeTension;
+            step.tensionGain = tensionGain;
+            step.tensionWidth = tensionWidth;
+            step.polyColor = polygonDiffuse;
+            step.springColor = springDiffuse;
+            step.emitter = emitter.getSettings();
+            step.emitter.mass = mass;
+            step.emitter.radius = radius;
+            step.emitter.bounce = bounce;
+            step.emitter.springStrength = springStrength;
+            step.emitter.springLength = springLength;
+            step.emitter.attraction = attraction;
+            step.emitter.makeSprings = makeSprings;
+            step.xpbd = xpbd.getSettings();
+            step.surface = surface.getSettings();
+        }
+        
+        // The next step picks the change up and bumps the revision once
+        // the snapshot holding it is published
+        void markChanged(){
+            worldChanged = true;
+        }
+        
+        // Hands the changes made since the last step to the one about to run
+        void beginStep(){
+            backChanged |= worldChanged;
+            worldChanged = false;
+        }
+        
+        void setGravityVec(const ofPoint& g){
+            physics.setGravity(g);
         }
         
         
@@ -108,14 +310,80 @@ namespace em {
         of3dPrimitive        polyPrimitive;
         of3dPrimitive        springPrimitive;
         
-        // Shading
+        // Shading, drawn from the front meshes while the next step fills the back ones
         ofVboMesh            polyMesh, springMesh;
+        ofMesh               backPolyMesh, backSpringMesh;
         ofShader             polyShader, springShader;
         ofMaterial           polyMat, springMat;
+        SpringTension        springTension;
+        
+        // Emitter
+        ParticleEmitter      emitter;
+        
+        // Constraint solver
+        XpbdSolver           xpbd;
+        
+        // Collision broad phase
+        CollisionGrid        collisionGrid;
+        
+        // Iso surface
+        SurfaceMesher        surface;
+        
+        // Sphere mode
+        SphereLod            sphereLod;
+        
+        // Culling and depth sort
+        VisibilityStage      visibility;
+        
+        // Picking
+        ParticlePicker                          picker;
+        msa::physics::Particle3D*               hovered;
+        msa::physics::Particle3D*               grabbed;
+        float                                   grabDistance;
+        bool                                    grabbedWasFixed;
+        
+        // Particles as of the published step, for sphere drawing and the hover highlight
+        vector<ofVec3f>                         particlePositions, backPositions;
+        vector<float>                           particleRadii, backRadii;
+        ofVec3f                                 hoverPosition;
+        float                                   hoverRadius;
+        bool                                    hoverFixed;
+        bool                                    backReady, backPolyChanged, backChanged;
+        float                                   stepMillis;
+        int                                     stepLimit;
+        StepSettings                            step;
+        
+        // Runs the step while the main thread draws; declared after the
+        // world so it is joined before the world goes away
+        SimulationThread                        simThread;
+        
+        // Bumped whenever the drawn result may differ from the last frame
+        uint64_t                                revision;
+        bool                                    worldChanged;
+        
+        // Batch construction
+        ClusterBuilder                          clusterBuilder;
+        vector<msa::physics::Particle3D*>       batchParticles;
+        
+        // Parameter changes applied once per frame
+        DeferredParameter<double>   pendingBoxSize;
+        DeferredParameter<ofPoint>  pendingGravity;
+        DeferredParameter<float>    pendingZDepth;
         
     public:
         
         MeshGenerator(){
+            hovered = grabbed = nullptr;
+            hoverRadius = 0;
+            hoverFixed = false;
+            backReady = backPolyChanged = backChanged = false;
+            stepMillis = 0;
+            stepLimit = MESH_MAX_STEPS;
+            step = StepSettings();
+            revision = 0;
+            worldChanged = false;
+            grabDistance = 0;
+            grabbedWasFixed = false;
             fixedParticlePos.setPosition(ofPoint(0,0,0));
             fixedParticlePos.setRepeatType(PLAY_ONCE);
             fixedParticlePos.setCurve(EXPONENTIAL_SIGMOID_PARAM);
@@ -131,15 +399,18 @@ namespace em {
         }
         
         ~MeshGenerator(){
-            zDepth.removeListener(this, &MeshGenerator::setZDepth);
-            gravity.removeListener(this, &MeshGenerator::setGravityVec);
-            boxSize.removeListener(this, &MeshGenerator::setPhysicsBoxSize);
+            simThread.wait();
+            pendingBoxSize.unbind();
+            pendingGravity.unbind();
+            pendingZDepth.unbind();
         }
         void setup(){
             params.setName("Mesh Generator");
             params.add(boxSize.set("Box size", 100.0, 1.0, 2000.0));
             
             params.add(physicsPaused.set("Paused", false));
+            params.add(threadedPhysics.set("Threaded physics", true));
+            params.add(stepsPerFrame.set("Steps per frame", 1, 1, MESH_MAX_STEPS));
             params.add(gravity.set("Gravity", ofPoint(0, 0, 0), ofPoint(-1, -1, -1), ofPoint(1, 1, 1)));
             params.add(attraction.set("Attraction", MIN_ATTRACTION, MIN_ATTRACTION, MAX_ATTRACTION));
             params.add(bindToFixedParticle.set("Bind to center", true));
@@ -147,14 +418,35 @@ namespace em {
             params.add(mass.set("Particle Mass", MIN_MASS, MIN_MASS, MAX_MASS));
             params.add(bounce.set("Particle Bounce", MIN_BOUNCE, MIN_BOUNCE, MAX_BOUNCE));
             params.add(drag.set("Drag", 0.97, 0.0, 1.0));
+            params.add(collisions.set("Collisions", false));
             params.add(springStrength.set("Spring Strength", SPRING_MIN_STRENGTH, SPRING_MIN_STRENGTH, SPRING_MAX_STRENGTH));
             params.add(springLength.set("Spring Length", SPRING_MIN_LENGTH, SPRING_MIN_LENGTH, SPRING_MAX_LENGTH));
             params.add(zDepth.set("Z Depth", 50, 0, 400));
+            params.add(visualizeTension.set("Spring tension", false));
+            params.add(tensionGain.set("Tension gain", 4, 0.1, 20));
+            params.add(tensionWidth.set("Tension width", 2, 1, 10));
             params.add(makeParticles.set("Make Particles", true));
             params.add(makeSprings.set("Make Springs", true));
-            params.add(particleCount.set("Particle Count", 0));
-            params.add(springCount.set("Spring Count", 0));
-            params.add(attractionCount.set("Attraction Count", 0));
+            params.add(batchSize.set("Batch Size", 1000, 2, MAX_BATCH_PARTICLES));
+            params.add(batchTopology.set("Batch Topology", CLUSTER_KNN, 0, CLUSTER_TOPOLOGY_COUNT - 1));
+            params.add(batchNeighbours.set("Batch Neighbours", 4, 1, 12));
+            emitter.setup();
+            params.add(emitter.params);
+            xpbd.setup();
+            params.add(xpbd.params);
+            surface.setup();
+            params.add(surface.params);
+            sphereLod.setup();
+            params.add(sphereLod.params);
+            visibility.setup();
+            params.add(visibility.params);
+            stats.setName("Stats");
+            stats.add(particleCount.set("Particle Count", 0));
+            stats.add(springCount.set("Spring Count", 0));
+            stats.add(attractionCount.set("Attraction Count", 0));
+            stats.add(contactCount.set("Contact Count", 0));
+            stats.add(physicsTime.set("Physics ms", 0));
+            params.add(stats);
             
             params.add(polygonAmbient.set("Polygon Ambient", ofFloatColor(1,1,1,.1), ofFloatColor(0,0,0,0), ofFloatColor(1,1,1,1)));
             polygonDiffuse.set("Diffuse", ofFloatColor(0.8,0.8,0.8,1.0), ofFloatColor(0,0,0,0), ofFloatColor(1,1,1,1));
@@ -166,17 +458,41 @@ namespace em {
             springSpecular.set("Specular", ofFloatColor(0.8,0.8,0.8,1.0), ofFloatColor(0,0,0,0), ofFloatColor(1,1,1,1));
             springShininess.set("Spring Shininess", 10, 0, 255);
             
-            boxSize.addListener(this, &MeshGenerator::setPhysicsBoxSize);
-            zDepth.addListener(this, &MeshGenerator::setZDepth);
-            gravity.addListener(this, &MeshGenerator::setGravityVec);
+            pendingBoxSize.bind(boxSize);
+            pendingZDepth.bind(zDepth);
+            pendingGravity.bind(gravity);
         }
         
         void update(){
+            // Nothing may touch the world while a step is running
+            simThread.wait();
+            applyPendingParams();
             updateShading();
-            updatePhysics();
+            if (threadedPhysics) {
+                // Draw the step that finished during the last frame while the next one runs
+                publishFrame();
+                beginStep();
+                simThread.start([this]{ updatePhysics(); });
+            } else {
+                beginStep();
+                updatePhysics();
+                publishFrame();
+            }
         }
         
-        void draw(bool drawPolyMesh=true, bool drawSpringMesh=true, bool drawWireframe=false){
+        // Call once the frame is drawn, input events and gui edits change
+        // the world directly and must not run alongside a step
+        void waitForPhysics(){
+            simThread.wait();
+        }
+        
+        // `instancedShader` tells that the caller bound a shader that places
+        // instances from INSTANCE_ATTRIBUTE, the spheres then draw under it
+        void draw(const ofCamera& cam, bool drawPolyMesh=true, bool drawSpringMesh=true, bool drawWireframe=false,
+                  bool instancedShader=false){
+            ofRectangle viewport = ofGetCurrentViewport();
+            visibility.setCamera(cam, viewport.width / max(viewport.height, 1.f));
+            
             if (drawPolyMesh) {
                 // Draw polygon mesh
                 polyMat.begin();
@@ -185,29 +501,54 @@ namespace em {
                 polyMat.end();
                 
             } else {
-                polyMat.begin();
-                for (int i=0; i<physics.numberOfParticles(); i++) {
-                    auto p = physics.getParticle(i);
-                    ofPushMatrix();
-                    ofTranslate(p->getPosition());
-//                    float distToCam = p->getPosition().distance(previewCam.getGlobalPosition()) / 10;
-//                    ofSetColor(255.0, ofClamp(255 - distToCam, 0, 255));
-                    ofDrawSphere(p->getRadius());
-                    ofPopMatrix();
-                }
-                polyMat.end();
+                // Visible spheres back to front, at a detail level matching their size on screen
+                visibility.updateParticles(particlePositions, particleRadii);
+                bool translucent = polyMat.getDiffuseColor().a < 1;
+                sphereLod.classify(particlePositions, particleRadii, visibility.getParticleOrder(), cam, viewport.height, translucent);
+                sphereLod.draw(polyMat, drawWireframe, instancedShader);
+            }
+            if (hoverRadius > 0) {
+                ofPushStyle();
+                ofNoFill();
+                ofSetColor(hoverFixed ? ofColor(255, 80, 80) : ofColor(255, 200, 0));
+                ofDrawSphere(hoverPosition, hoverRadius * 1.25f);
+                ofPopStyle();
             }
             if (drawSpringMesh) {
+                const ofVboMesh& lines = springMesh;
+                visibility.updateSprings(lines.getVertices());
+                springMesh.clearIndices();
+                springMesh.addIndices(visibility.getSpringIndices());
                 //            springMat.begin();
-                if (drawWireframe)  springMesh.drawWireframe();
-                else                springMesh.draw();
+                if (visibility.getSpringIndices().empty()) {
+                    // All culled, drawn without indices the vbo would pair up every vertex
+                } else if (drawWireframe) {
+                    springMesh.drawWireframe();
+                } else if (visualizeTension) {
+                    // Compiled on first use so setup() needs no GL context
+                    if (!springShader.isLoaded()) setupSpringShader();
+                    springShader.begin();
+                    springShader.setUniform2f("viewport", viewport.width, viewport.height);
+                    springMesh.draw();
+                    springShader.end();
+                } else {
+                    springMesh.draw();
+                }
                 //            springMat.end();
             }
         }
         
         void clear(){
+            simThread.wait();
+            hovered = grabbed = nullptr;
+            hoverRadius = 0;
+            picker.clear();
+            surface.clear();
+            xpbd.clear();
+            emitter.clear();
             physics.clear();
             physics.addParticle(&fixedParticle);
+            markChanged();
         }
         
         void saveMesh(bool savePolyMesh=true, bool saveSpringMesh=true){
@@ -226,6 +567,7 @@ namespace em {
         
         //--------------------------------------------------------------
         void makeParticleAtCenter(float r){
+            if (physics.numberOfParticles() >= MAX_PARTICLES) return;
             auto a = new msa::physics::Particle3D;
             a->setMass(mass)
             ->setBounce(bounce)
@@ -237,10 +579,12 @@ namespace em {
                              ofRandom(-r, r)));
             
             physics.addParticle(a);
+            markChanged();
         }
         
         //--------------------------------------------------------------
         void makeParticleAtPosition(const ofPoint& p){
+            if (physics.numberOfParticles() >= MAX_PARTICLES) return;
             auto a = new msa::physics::Particle3D;
             a->setMass(mass)
             ->setBounce(bounce)
@@ -249,6 +593,7 @@ namespace em {
             ->makeFree()
             ->moveTo(p);
             physics.addParticle(a);
+            markChanged();
             
             if (attraction > 0.0f) {
                 physics.makeAttraction(a, &fixedParticle, attraction);
@@ -299,15 +644,184 @@ namespace em {
             }
         }
 
-        void setPhysicsBoxSize(double& s){
+        //--------------------------------------------------------------
+        // Builds a whole cluster in one call: positions and edges come from
+        // ClusterBuilder, then particles, springs and attractions are
+        // inserted in a single pass without per-spring duplicate scans.
+        // Springs rest at their built length so the structure keeps its shape.
+        void makeClusterBatch(int count, ClusterTopology topology, int neighbours=4){
+            count = min(count, MAX_BATCH_PARTICLES - (int) physics.numberOfParticles());
+            if (count <= 0) return;
+            
+            clusterBuilder.build(count, topology, boxSize * 0.8f, neighbours);
+            const vector<ofVec3f>& positions = clusterBuilder.getPositions();
+            
+            batchParticles.clear();
+            batchParticles.reserve(positions.size());
+            for (auto & pos : positions) {
+                auto a = new msa::physics::Particle3D;
+                a->setMass(mass)
+                ->setBounce(bounce)
+                ->setRadius(radius)
+                ->enableCollision()
+                ->makeFree()
+                ->moveTo(pos);
+                physics.addParticle(a);
+                a->release();
+                batchParticles.push_back(a);
+                if (attraction > 0.0f) physics.makeAttraction(a, &fixedParticle, attraction);
+            }
+            
+            if (makeSprings) {
+                for (auto & e : clusterBuilder.getEdges()) {
+                    auto a = batchParticles[e.first];
+                    auto b = batchParticles[e.second];
+                    physics.makeSpring(a, b, springStrength, a->getPosition().distance(b->getPosition()));
+                }
+                if (bindToFixedParticle) {
+                    // Anchor the particle closest to the center
+                    size_t nearest = 0;
+                    for (size_t i = 1; i < positions.size(); i++) {
+                        if (positions[i].lengthSquared() < positions[nearest].lengthSquared()) nearest = i;
+                    }
+                    physics.makeSpring(batchParticles[nearest], &fixedParticle, springStrength, springLength);
+                }
+            }
+            markChanged();
+        }
+        
+        void makeClusterBatch(){
+            makeClusterBatch(batchSize, (ClusterTopology) (int) batchTopology, batchNeighbours);
+        }
+
+        //--------------------------------------------------------------
+        // Picking, rays are in world space with a normalised direction.
+        // The center particle is driven by its animation so it is never picked.
+        msa::physics::Particle3D* pick(const ofVec3f& origin, const ofVec3f& dir, float* distance=nullptr){
+            auto p = picker.getParticle(picker.pick(origin, dir, distance));
+            return p == &fixedParticle ? nullptr : p;
+        }
+        
+        void hover(const ofVec3f& origin, const ofVec3f& dir){
+            auto p = grabbed ? grabbed : pick(origin, dir);
+            if (p != hovered) revision++;
+            hovered = p;
+        }
+        
+        // Holds the particle under the ray fixed while it is dragged
+        bool grab(const ofVec3f& origin, const ofVec3f& dir){
+            release();
+            grabbed = pick(origin, dir, &grabDistance);
+            if (!grabbed) return false;
+            grabbedWasFixed = grabbed->isFixed();
+            grabbed->makeFixed();
+            hovered = grabbed;
+            revision++;
+            return true;
+        }
+        
+        // Keeps the grabbed particle at its original distance along the ray
+        void dragTo(const ofVec3f& origin, const ofVec3f& dir){
+            if (!grabbed || !isVisible(grabbed)) return;
+            grabbed->moveTo(origin + dir * grabDistance);
+            markChanged();
+            // The highlight follows the live particle at once
+            revision++;
+        }
+        
+        // A particle the emitter parked while it was held stays fixed as parked
+        void release(){
+            if (grabbed && !grabbedWasFixed && !emitter.isParked(grabbed)) grabbed->makeFree();
+            grabbed = nullptr;
+        }
+        
+        bool isGrabbing() const {
+            return grabbed != nullptr;
+        }
+        
+        // Pinned particles stay fixed where they are until toggled again
+        bool togglePin(const ofVec3f& origin, const ofVec3f& dir){
+            auto p = pick(origin, dir);
+            if (!p) return false;
+            if (p == grabbed)           grabbedWasFixed = !grabbedWasFixed;
+            else if (p->isFixed())      p->makeFree();
+            else                        p->makeFixed();
+            revision++;
+            return true;
+        }
+        
+        void setPhysicsBoxSize(double s){
             physics.setWorldSize(ofVec3f(-s, -s, -s), ofVec3f(s, s, s));
         }
         
+        // Quality limits set from outside, the parameters stay as they are.
+        // Call between frames, not while a step may be running.
+        void setStepLimit(int steps){
+            stepLimit = ofClamp(steps, 1, MESH_MAX_STEPS);
+        }
+        
+        void setSphereDetailBias(int bias){
+            sphereLod.setDetailBias(bias);
+        }
+        
+        uint64_t getRevision() const {
+            return revision;
+        }
+        
+        // One step on the calling thread without publishing it, for headless runs
+        void stepNow(){
+            simThread.wait();
+            applyPendingParams();
+            beginStep();
+            updatePhysics();
+        }
+        
+        // Particles in the published snapshot, the ones draw() shows
+        int getDrawnParticleCount() const {
+            return particlePositions.size();
+        }
+        
+        msa::physics::World3D& getPhysics(){
+            return physics;
+        }
+        
+        // Spreads every particle over [-v, v] in z at random
+        void setZDepth(float v) {
+            for (int i=0; i<physics.numberOfParticles(); i++) {
+                auto p = physics.getParticle(i);
+                ofPoint pos(p->getPosition());
+                pos.z = ofRandom(-v, v);
+                p->moveTo(pos);
+            }
+            markChanged();
+        }
+        
+        template <typename T>
+        void makeSpringBetweenParticles(msa::physics::ParticleT<T> *a,
+                                        msa::physics::ParticleT<T> *b){
+            float dist = a->getPosition().distance(b->getPosition());
+            float strength = dist*springStrength;
+            bool springExists = false;
+            for (int i=0; i<physics.numberOfSprings(); i++) {
+                auto s = physics.getSpring(i);
+                if ((s->getOneEnd() == a || s->getTheOtherEnd() == a) &&
+                    (s->getOneEnd() == b || s->getTheOtherEnd() == b)) {
+                    springExists = true;
+                    return;
+                }
+            }
+            if (!springExists) {
+                physics.makeSpring(a, b, springStrength, springLength);
+                markChanged();
+            }
+        }
+        
         ofPoint getFixedParticlePosition(){
             return fixedParticle.getPosition();
         }
         
         ofParameterGroup params;
+        ofParameterGroup stats;
         ofParameter<double>  boxSize;
         
         // Physics params
@@ -323,9 +837,17 @@ namespace em {
         ofParameter<int>     particleCount;
         ofParameter<int>     springCount;
         ofParameter<int>     attractionCount;
+        ofParameter<int>     contactCount;
+        ofParameter<float>   physicsTime;
         ofParameter<bool>    makeParticles, makeSprings;
+        ofParameter<int>     batchSize, batchTopology, batchNeighbours;
         ofParameter<bool>    bindToFixedParticle;
         ofParameter<bool>    physicsPaused;
+        ofParameter<bool>    threadedPhysics;
+        ofParameter<int>     stepsPerFrame;
+        ofParameter<bool>    collisions;
+        ofParameter<bool>    visualizeTension;
+        ofParameter<float>   tensionGain, tensionWidth;
         
         // Shading
         ofParameter<ofFloatColor>   polygonAmbient, polygonDiffuse, polygonSpecular;
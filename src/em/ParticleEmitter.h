@@ -0,0 +1,223 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Continuous particle source with a lifetime and a hard cap. Every slot
+    // owns one particle, the spring to the slot emitted before it and an
+    // attraction to the center. Expired slots are parked on a free list
+    // (fixed, zero radius, constraints off) and reused by the next spawn,
+    // so nothing is allocated once the pool has reached the cap.
+    class ParticleEmitter {
+
+        struct Slot {
+            msa::physics::Particle3D*       particle;
+            msa::physics::Spring3D*         spring;      // to the previous slot
+            msa::physics::Attraction3D*     attraction;  // to the center
+            float                           age, lifetime;
+            bool                            alive;
+        };
+
+    public:
+
+        // Plain copy of everything update() reads, taken on the main thread.
+        // The particle and spring values come from the generator, the rest
+        // from getSettings().
+        struct Settings {
+            float   mass, radius, bounce;
+            float   springStrength, springLength;
+            float   attraction;
+            bool    makeSprings;
+            bool    enabled;
+            float   rate, lifetime, lifetimeJitter;
+            int     cap;
+            ofPoint position;
+            float   spread, speed;
+        };
+
+    private:
+
+        void park(int index, const ofPoint& home){
+            Slot& slot = slots[index];
+            slot.alive = false;
+            slot.particle->makeFixed()
+            ->disableCollision()
+            ->setRadius(0)
+            ->moveTo(home);
+            setConstraint(slot.spring, false);
+            setConstraint(slot.attraction, false);
+            if (index + 1 < (int) slots.size()) setConstraint(slots[index + 1].spring, false);
+            freeList.push_back(index);
+        }
+
+        template <typename C>
+        void setConstraint(C* c, bool on){
+            if (!c) return;
+            if (on) c->turnOn();
+            else    c->turnOff();
+        }
+
+        int allocate(msa::physics::World3D& physics, msa::physics::Particle3D& center, const Settings& s){
+            if (!freeList.empty()) {
+                int index = freeList.back();
+                freeList.pop_back();
+                return index;
+            }
+            if ((int) slots.size() >= s.cap || (int) physics.numberOfParticles() >= MAX_BATCH_PARTICLES) return -1;
+
+            Slot slot;
+            slot.particle = new msa::physics::Particle3D;
+            physics.addParticle(slot.particle);
+            slot.particle->release();
+            slot.spring = nullptr;
+            slot.attraction = physics.makeAttraction(slot.particle, &center, s.attraction);
+            if (!slots.empty()) {
+                slot.spring = physics.makeSpring(slots.back().particle, slot.particle, s.springStrength, s.springLength);
+            }
+            slots.push_back(slot);
+            return slots.size() - 1;
+        }
+
+        void spawn(msa::physics::World3D& physics, msa::physics::Particle3D& center, const Settings& s){
+            int index = allocate(physics, center, s);
+            if (index < 0) return;
+
+            Slot& slot = slots[index];
+            slot.alive = true;
+            slot.age = 0;
+            slot.lifetime = s.lifetime * (1 + ofRandom(-s.lifetimeJitter, s.lifetimeJitter));
+
+            ofPoint origin = s.position + ofPoint(ofRandomf(), ofRandomf(), ofRandomf()) * s.spread;
+            ofPoint velocity = ofPoint(ofRandomf(), ofRandomf(), ofRandomf()).getNormalized() * s.speed;
+            slot.particle->setMass(s.mass)
+            ->setBounce(s.bounce)
+            ->setRadius(s.radius)
+            ->enableCollision()
+            ->makeFree()
+            ->moveTo(origin);
+            slot.particle->addVelocity(velocity);
+
+            if (slot.attraction) {
+                slot.attraction->setStrength(s.attraction);
+                setConstraint(slot.attraction, s.attraction > 0);
+            }
+            // Link to the neighbouring slots that are currently alive
+            if (slot.spring) {
+                slot.spring->setStrength(s.springStrength)->setRestLength(s.springLength);
+                setConstraint(slot.spring, s.makeSprings && slots[index - 1].alive);
+            }
+            if (index + 1 < (int) slots.size() && slots[index + 1].spring) {
+                auto next = slots[index + 1].spring;
+                next->setStrength(s.springStrength)->setRestLength(s.springLength);
+                setConstraint(next, s.makeSprings && slots[index + 1].alive);
+            }
+            aliveCount++;
+        }
+
+        vector<Slot>    slots;
+        vector<int>     freeList;
+        float           spawnDebt;
+        int             aliveCount;
+
+    public:
+
+        ParticleEmitter(){
+            slots.reserve(MAX_PARTICLES);
+            freeList.reserve(MAX_PARTICLES);
+            spawnDebt = 0;
+            aliveCount = 0;
+        }
+
+        void setup(){
+            params.setName("Emitter");
+            params.add(enabled.set("Enabled", false));
+            params.add(rate.set("Spawn rate", 20, 0, 500));
+            params.add(lifetime.set("Lifetime", 10, 0.5, 120));
+            params.add(lifetimeJitter.set("Lifetime jitter", 0.25, 0, 1));
+            params.add(cap.set("Cap", 500, 1, MAX_PARTICLES));
+            params.add(position.set("Position", ofPoint(0, 0, 0), ofPoint(-1000, -1000, -1000), ofPoint(1000, 1000, 1000)));
+            params.add(spread.set("Spread", 20, 0, 500));
+            params.add(speed.set("Speed", 2, 0, 50));
+            stats.setName("Stats");
+            stats.add(alive.set("Alive", 0));
+            stats.add(pooled.set("Pooled", 0));
+            params.add(stats);
+        }
+
+        void update(msa::physics::World3D& physics, msa::physics::Particle3D& center, const Settings& s, float dt){
+            // Age out before spawning so expired slots are reused this frame
+            for (int i = 0; i < (int) slots.size(); i++) {
+                Slot& slot = slots[i];
+                if (!slot.alive) continue;
+                slot.age += dt;
+                if (slot.age >= slot.lifetime) {
+                    park(i, center.getPosition());
+                    aliveCount--;
+                }
+            }
+
+            if (s.enabled) {
+                spawnDebt += s.rate * dt;
+                int limit = min(s.cap, MAX_PARTICLES);
+                while (spawnDebt >= 1 && aliveCount < limit) {
+                    spawn(physics, center, s);
+                    spawnDebt -= 1;
+                }
+                // Don't bank spawns while saturated
+                spawnDebt = min(spawnDebt, 1.f);
+            }
+        }
+
+        // The emitter's own parameters, leaves the particle values unset
+        Settings getSettings() const {
+            Settings s;
+            s.enabled = enabled;
+            s.rate = rate;
+            s.lifetime = lifetime;
+            s.lifetimeJitter = lifetimeJitter;
+            s.cap = cap;
+            s.position = position;
+            s.spread = spread;
+            s.speed = speed;
+            return s;
+        }
+
+        // True for one of our particles that is parked on the free list
+        bool isParked(const msa::physics::Particle3D* p) const {
+            for (auto & slot : slots) {
+                if (slot.particle == p) return !slot.alive;
+            }
+            return false;
+        }
+
+        // Counters go to the gui from the main thread, never from the step
+        void publishStats(){
+            alive.set(aliveCount);
+            pooled.set(slots.size());
+        }
+
+        // The world owns the particles, drop our references after it was cleared
+        void clear(){
+            slots.clear();
+            freeList.clear();
+            spawnDebt = 0;
+            aliveCount = 0;
+        }
+
+        ofParameterGroup        params;
+        ofParameterGroup        stats;
+        ofParameter<bool>       enabled;
+        ofParameter<float>      rate;
+        ofParameter<float>      lifetime;
+        ofParameter<float>      lifetimeJitter;
+        ofParameter<int>        cap;
+        ofParameter<ofPoint>    position;
+        ofParameter<float>      spread;
+        ofParameter<float>      speed;
+        ofParameter<int>        alive;
+        ofParameter<int>        pooled;
+    };
+}
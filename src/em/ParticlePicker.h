@@ -0,0 +1,215 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Ray picking over particle spheres through a bounding volume hierarchy.
+    // The tree is built once by median splits and then only refit bottom-up
+    // after each physics step; it is rebuilt when the particle count
+    // changes or the refit bounds have grown too loose.
+    class ParticlePicker {
+
+        struct Node {
+            ofVec3f     min, max;
+            int         right;      // internal: right child, left child is the next node
+            int         first;      // leaf: first entry in `prims`
+            int         count;      // leaf: number of prims, 0 for internal nodes
+        };
+
+        static float surfaceArea(const Node& n){
+            ofVec3f d = n.max - n.min;
+            return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        void primBounds(int prim, ofVec3f& lo, ofVec3f& hi) const {
+            const ofVec3f& c = centers[prim];
+            float r = radii[prim];
+            lo.set(c.x - r, c.y - r, c.z - r);
+            hi.set(c.x + r, c.y + r, c.z + r);
+        }
+
+        void grow(Node& n, const ofVec3f& lo, const ofVec3f& hi) const {
+            n.min.set(min(n.min.x, lo.x), min(n.min.y, lo.y), min(n.min.z, lo.z));
+            n.max.set(max(n.max.x, hi.x), max(n.max.y, hi.y), max(n.max.z, hi.z));
+        }
+
+        void resetBounds(Node& n) const {
+            float big = numeric_limits<float>::max();
+            n.min.set(big, big, big);
+            n.max.set(-big, -big, -big);
+        }
+
+        int buildNode(int first, int count){
+            int index = nodes.size();
+            nodes.push_back(Node());
+            Node node;
+            resetBounds(node);
+            ofVec3f cmin = node.min, cmax = node.max;
+            for (int i = first; i < first + count; i++) {
+                ofVec3f lo, hi;
+                primBounds(prims[i], lo, hi);
+                grow(node, lo, hi);
+                const ofVec3f& c = centers[prims[i]];
+                cmin.set(min(cmin.x, c.x), min(cmin.y, c.y), min(cmin.z, c.z));
+                cmax.set(max(cmax.x, c.x), max(cmax.y, c.y), max(cmax.z, c.z));
+            }
+            node.right = -1;
+            node.first = first;
+            node.count = count;
+
+            if (count > PICKER_LEAF_SIZE) {
+                ofVec3f extent = cmax - cmin;
+                int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+                int mid = first + count / 2;
+                nth_element(prims.begin() + first, prims.begin() + mid, prims.begin() + first + count,
+                            [&](uint32_t a, uint32_t b){ return centers[a][axis] < centers[b][axis]; });
+                node.count = 0;
+                buildNode(first, mid - first);
+                node.right = buildNode(mid, first + count - mid);
+            }
+            nodes[index] = node;
+            return index;
+        }
+
+        bool hitBox(const Node& n, const ofVec3f& origin, const ofVec3f& invDir, float tMax) const {
+            float t0 = 0, t1 = tMax;
+            for (int a = 0; a < 3; a++) {
+                float tn = (n.min[a] - origin[a]) * invDir[a];
+                float tf = (n.max[a] - origin[a]) * invDir[a];
+                if (tn > tf) swap(tn, tf);
+                t0 = max(t0, tn);
+                t1 = min(t1, tf);
+                if (t0 > t1) return false;
+            }
+            return true;
+        }
+
+        float hitSphere(int prim, const ofVec3f& origin, const ofVec3f& dir) const {
+            float r = radii[prim];
+            if (r <= 0) return -1;
+            ofVec3f oc = origin - centers[prim];
+            float b = oc.dot(dir);
+            float c = oc.lengthSquared() - r * r;
+            float disc = b * b - c;
+            if (disc < 0) return -1;
+            float s = sqrt(disc);
+            float t = -b - s;
+            if (t < 0) t = -b + s;
+            return t;
+        }
+
+        vector<msa::physics::Particle3D*>   particles;
+        vector<ofVec3f>                     centers;
+        vector<float>                       radii;
+        vector<uint32_t>                    prims;
+        vector<Node>                        nodes;
+        float                               builtArea;
+
+    public:
+
+        ParticlePicker(){
+            builtArea = 0;
+        }
+
+        // Call once per physics step
+        void update(msa::physics::World3D& physics){
+            size_t n = physics.numberOfParticles();
+            bool rebuild = n != particles.size();
+            particles.resize(n);
+            centers.resize(n);
+            radii.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                auto p = physics.getParticle(i);
+                if (particles[i] != p) rebuild = true;
+                particles[i] = p;
+                centers[i] = p->getPosition();
+                radii[i] = p->getRadius();
+            }
+            if (n == 0) {
+                nodes.clear();
+                return;
+            }
+            if (!rebuild) {
+                refit();
+                rebuild = surfaceArea(nodes[0]) > builtArea * PICKER_REBUILD_GROWTH;
+            }
+            if (rebuild) build();
+        }
+
+        void build(){
+            prims.resize(particles.size());
+            for (size_t i = 0; i < prims.size(); i++) prims[i] = i;
+            nodes.clear();
+            nodes.reserve(prims.size() * 2 / PICKER_LEAF_SIZE + 1);
+            buildNode(0, prims.size());
+            builtArea = max(surfaceArea(nodes[0]), 0.0001f);
+        }
+
+        // Children always follow their parent, so a reverse sweep sees them first
+        void refit(){
+            for (int i = nodes.size() - 1; i >= 0; i--) {
+                Node& node = nodes[i];
+                resetBounds(node);
+                if (node.count > 0) {
+                    for (int k = node.first; k < node.first + node.count; k++) {
+                        ofVec3f lo, hi;
+                        primBounds(prims[k], lo, hi);
+                        grow(node, lo, hi);
+                    }
+                } else {
+                    const Node& l = nodes[i + 1];
+                    const Node& r = nodes[node.right];
+                    grow(node, l.min, l.max);
+                    grow(node, r.min, r.max);
+                }
+            }
+        }
+
+        // Nearest particle hit by the ray, -1 if none. `dir` must be normalised.
+        int pick(const ofVec3f& origin, const ofVec3f& dir, float* hitDistance=nullptr) const {
+            if (nodes.empty()) return -1;
+            ofVec3f invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+            float best = numeric_limits<float>::max();
+            int hit = -1;
+            int stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Node& node = nodes[stack[--top]];
+                if (!hitBox(node, origin, invDir, best)) continue;
+                if (node.count > 0) {
+                    for (int k = node.first; k < node.first + node.count; k++) {
+                        float t = hitSphere(prims[k], origin, dir);
+                        if (t >= 0 && t < best) {
+                            best = t;
+                            hit = prims[k];
+                        }
+                    }
+                } else if (top < 62) {
+                    stack[top++] = node.right;
+                    stack[top++] = &node - &nodes[0] + 1;
+                }
+            }
+            if (hitDistance && hit >= 0) *hitDistance = best;
+            return hit;
+        }
+
+        msa::physics::Particle3D* getParticle(int index) const {
+            return index >= 0 && index < (int) particles.size() ? particles[index] : nullptr;
+        }
+
+        void clear(){
+            particles.clear();
+            centers.clear();
+            radii.clear();
+            nodes.clear();
+        }
+
+        size_t getNodeCount() const {
+            return nodes.size();
+        }
+    };
+}
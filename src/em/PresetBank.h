@@ -0,0 +1,444 @@
+#pragma once
+
+#include "ofMain.h"
+
+#define PRESET_BANK_MAGIC       0x42504d45  // "EMPB"
+#define PRESET_BANK_VERSION     1
+
+
+namespace em {
+    // In-memory bank of parameter snapshots. Every numeric parameter of the
+    // registered groups is flattened into a float slot layout once, so
+    // recalling a preset is a straight copy and a morph only walks the
+    // slots that actually differ between the two presets. Any change of a
+    // registered value bumps a revision counter through its listener.
+    class PresetBank {
+
+        enum SlotType {
+            SLOT_FLOAT, SLOT_DOUBLE, SLOT_INT, SLOT_BOOL, SLOT_POINT, SLOT_COLOR
+        };
+
+        struct Slot {
+            string                  path;
+            SlotType                type;
+            ofAbstractParameter*    param;
+            int                     offset;
+            int                     size;
+            bool                    quiet;
+            bool                    discrete;   // switched at the end of a morph, not blended
+        };
+
+        struct Preset {
+            string          name;
+            vector<float>   values;
+        };
+
+        static int slotSize(SlotType type){
+            switch (type) {
+                case SLOT_POINT: return 3;
+                case SLOT_COLOR: return 4;
+                default:         return 1;
+            }
+        }
+
+        void addSlot(ofAbstractParameter& param, const string& path, SlotType type){
+            Slot slot;
+            slot.path = path;
+            slot.type = type;
+            slot.param = &param;
+            slot.offset = valueCount;
+            slot.size = slotSize(type);
+            slot.quiet = find(quietPaths.begin(), quietPaths.end(), path) != quietPaths.end();
+            slot.discrete = type == SLOT_BOOL || find(discretePaths.begin(), discretePaths.end(), path) != discretePaths.end();
+            valueCount += slot.size;
+            slots.push_back(slot);
+            listen(slot, true);
+        }
+
+        template <typename T>
+        void onValueChanged(T& v){
+            revision++;
+        }
+
+        template <typename T>
+        void listen(ofAbstractParameter& p, bool on){
+            if (on) p.cast<T>().addListener(this, &PresetBank::onValueChanged<T>);
+            else    p.cast<T>().removeListener(this, &PresetBank::onValueChanged<T>);
+        }
+
+        void listen(const Slot& slot, bool on){
+            switch (slot.type) {
+                case SLOT_FLOAT:  listen<float>(*slot.param, on); break;
+                case SLOT_DOUBLE: listen<double>(*slot.param, on); break;
+                case SLOT_INT:    listen<int>(*slot.param, on); break;
+                case SLOT_BOOL:   listen<bool>(*slot.param, on); break;
+                case SLOT_POINT:  listen<ofPoint>(*slot.param, on); break;
+                case SLOT_COLOR:  listen<ofFloatColor>(*slot.param, on); break;
+            }
+        }
+
+        // Quiet slots are set without notifying their listeners
+        template <typename T>
+        void assign(const Slot& slot, const T& v){
+            if (slot.quiet) {
+                slot.param->cast<T>().setWithoutEventNotifications(v);
+                revision++;
+            } else {
+                slot.param->cast<T>() = v;
+            }
+        }
+
+        void readSlot(const Slot& slot, float* out) const {
+            ofAbstractParameter& p = *slot.param;
+            switch (slot.type) {
+                case SLOT_FLOAT:  out[0] = p.cast<float>().get(); break;
+                case SLOT_DOUBLE: out[0] = p.cast<double>().get(); break;
+                case SLOT_INT:    out[0] = p.cast<int>().get(); break;
+                case SLOT_BOOL:   out[0] = p.cast<bool>().get() ? 1 : 0; break;
+                case SLOT_POINT: {
+                    const ofPoint& v = p.cast<ofPoint>().get();
+                    out[0] = v.x; out[1] = v.y; out[2] = v.z;
+                    break;
+                }
+                case SLOT_COLOR: {
+                    const ofFloatColor& c = p.cast<ofFloatColor>().get();
+                    out[0] = c.r; out[1] = c.g; out[2] = c.b; out[3] = c.a;
+                    break;
+                }
+            }
+        }
+
+        void writeSlot(const Slot& slot, const float* v){
+            switch (slot.type) {
+                case SLOT_FLOAT:  assign(slot, v[0]); break;
+                case SLOT_DOUBLE: assign(slot, (double) v[0]); break;
+                case SLOT_INT:    assign(slot, (int) round(v[0])); break;
+                case SLOT_BOOL:   assign(slot, v[0] > 0.5f); break;
+                case SLOT_POINT:  assign(slot, ofPoint(v[0], v[1], v[2])); break;
+                case SLOT_COLOR:  assign(slot, ofFloatColor(v[0], v[1], v[2], v[3])); break;
+            }
+        }
+
+        // Picking a preset on the slider recalls it
+        void onCurrentChanged(int& index){
+            if (index != active) recall(index);
+        }
+
+        void capture(vector<float>& out) const {
+            out.resize(valueCount);
+            for (auto & slot : slots) {
+                readSlot(slot, &out[slot.offset]);
+            }
+        }
+
+        // Work out once which slots move during the morph and by how much
+        void planMorph(const vector<float>& from, const vector<float>& to){
+            morphSlots.clear();
+            morphSwitches.clear();
+            morphFrom.clear();
+            morphDelta.clear();
+            for (size_t i = 0; i < slots.size(); i++) {
+                const Slot& slot = slots[i];
+                bool differs = false;
+                for (int c = 0; c < slot.size; c++) {
+                    if (from[slot.offset + c] != to[slot.offset + c]) differs = true;
+                }
+                if (!differs) continue;
+                if (slot.discrete) {
+                    morphSwitches.push_back(i);
+                    continue;
+                }
+                morphSlots.push_back(i);
+                for (int c = 0; c < slot.size; c++) {
+                    morphFrom.push_back(from[slot.offset + c]);
+                    morphDelta.push_back(to[slot.offset + c] - from[slot.offset + c]);
+                }
+            }
+        }
+
+        void applyMorph(float t){
+            float scratch[4];
+            size_t k = 0;
+            for (auto i : morphSlots) {
+                const Slot& slot = slots[i];
+                for (int c = 0; c < slot.size; c++, k++) {
+                    scratch[c] = morphFrom[k] + morphDelta[k] * t;
+                }
+                writeSlot(slot, scratch);
+            }
+        }
+
+        template <typename T>
+        static void put(string& out, const T& v){
+            out.append((const char*) &v, sizeof(T));
+        }
+        static void putString(string& out, const string& s){
+            put(out, (uint16_t) s.size());
+            out.append(s);
+        }
+        template <typename T>
+        static bool get(const char*& p, const char* end, T& v){
+            if (end - p < (ptrdiff_t) sizeof(T)) return false;
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+        static bool getString(const char*& p, const char* end, string& s){
+            uint16_t len;
+            if (!get(p, end, len) || end - p < len) return false;
+            s.assign(p, len);
+            p += len;
+            return true;
+        }
+
+        vector<Slot>        slots;
+        vector<string>      ignored, ignoredGroups, quietPaths, discretePaths;
+        int                 valueCount;
+        vector<Preset>      presets;
+        string              fileName;
+        int                 active;
+        uint64_t            revision;
+
+        // Morph plan
+        vector<int>         morphSlots, morphSwitches;
+        vector<float>       morphFrom, morphDelta;
+        int                 morphTarget;
+        float               morphStart, morphLength;
+        bool                bMorphing;
+
+    public:
+
+        PresetBank(){
+            valueCount = 0;
+            active = -1;
+            revision = 0;
+            morphTarget = -1;
+            morphStart = 0;
+            morphLength = 0;
+            bMorphing = false;
+        }
+
+        ~PresetBank(){
+            for (auto & slot : slots) listen(slot, false);
+            current.removeListener(this, &PresetBank::onCurrentChanged);
+        }
+
+        void setup(){
+            params.setName("Presets");
+            params.add(current.set("Current preset", -1, -1, 0));
+            params.add(morphDuration.set("Morph duration", 4, 0, 30));
+            params.add(morphProgress.set("Morph progress", 0, 0, 1));
+            current.addListener(this, &PresetBank::onCurrentChanged);
+        }
+
+        // Parameters the bank leaves alone, by path
+        void ignore(const string& path){
+            ignored.push_back(path);
+        }
+
+        // Groups skipped wherever they appear, e.g. the "Stats" group of
+        // counters that every module keeps
+        void ignoreGroups(const string& name){
+            ignoredGroups.push_back(name);
+        }
+
+        // Parameters whose listeners run a one-off action instead of
+        // following the value, e.g. re-spreading particles. Recall and
+        // morphs set them without notifying, call before add()
+        void quiet(const string& path){
+            quietPaths.push_back(path);
+        }
+
+        // Int parameters that pick one of several choices, e.g. a topology.
+        // Morphs switch them at the end like bools instead of walking
+        // through the choices in between, call before add()
+        void discrete(const string& path){
+            discretePaths.push_back(path);
+        }
+
+        void add(ofParameterGroup& group){
+            add(group, group.getName());
+        }
+
+        void add(ofParameterGroup& group, const string& prefix){
+            for (int i = 0; i < (int) group.size(); i++) {
+                ofAbstractParameter& p = group.get(i);
+                string path = prefix + "/" + p.getName();
+                if (find(ignored.begin(), ignored.end(), path) != ignored.end()) continue;
+
+                string type = p.type();
+                if (type == typeid(ofParameterGroup).name()) {
+                    if (find(ignoredGroups.begin(), ignoredGroups.end(), p.getName()) != ignoredGroups.end()) continue;
+                    add(static_cast<ofParameterGroup&>(p), path);
+                }
+                else if (type == typeid(ofParameter<float>).name())         addSlot(p, path, SLOT_FLOAT);
+                else if (type == typeid(ofParameter<double>).name())        addSlot(p, path, SLOT_DOUBLE);
+                else if (type == typeid(ofParameter<int>).name())           addSlot(p, path, SLOT_INT);
+                else if (type == typeid(ofParameter<bool>).name())          addSlot(p, path, SLOT_BOOL);
+                else if (type == typeid(ofParameter<ofPoint>).name())       addSlot(p, path, SLOT_POINT);
+                else if (type == typeid(ofParameter<ofFloatColor>).name())  addSlot(p, path, SLOT_COLOR);
+            }
+        }
+
+        // Read the whole bank into memory, mapping stored slots by path
+        bool load(const string& file){
+            fileName = file;
+            presets.clear();
+            ofBuffer buffer = ofBufferFromFile(file, true);
+            const char* p = buffer.getData();
+            const char* end = p + buffer.size();
+
+            uint32_t magic, version, slotCount, presetCount;
+            if (!get(p, end, magic) || magic != PRESET_BANK_MAGIC ||
+                !get(p, end, version) || version != PRESET_BANK_VERSION ||
+                !get(p, end, slotCount)) {
+                ofLogWarning("PresetBank") << "No preset bank found at " << file;
+                return false;
+            }
+
+            map<string, int> byPath;
+            for (size_t i = 0; i < slots.size(); i++) byPath[slots[i].path] = i;
+
+            // File slot -> current slot offset, -1 when it no longer exists
+            vector<int> fileOffsets, fileSizes, targetOffsets;
+            int fileValueCount = 0;
+            for (uint32_t i = 0; i < slotCount; i++) {
+                string path;
+                uint8_t type;
+                if (!getString(p, end, path) || !get(p, end, type)) return false;
+                int size = slotSize((SlotType) type);
+                auto it = byPath.find(path);
+                bool usable = it != byPath.end() && slots[it->second].type == type;
+                fileOffsets.push_back(fileValueCount);
+                fileSizes.push_back(size);
+                targetOffsets.push_back(usable ? slots[it->second].offset : -1);
+                fileValueCount += size;
+            }
+
+            vector<float> defaults;
+            capture(defaults);
+            if (!get(p, end, presetCount)) return false;
+            for (uint32_t i = 0; i < presetCount; i++) {
+                Preset preset;
+                if (!getString(p, end, preset.name)) return false;
+                if (end - p < (ptrdiff_t) (fileValueCount * sizeof(float))) return false;
+                const float* values = (const float*) p;
+                preset.values = defaults;
+                for (size_t s = 0; s < targetOffsets.size(); s++) {
+                    if (targetOffsets[s] < 0) continue;
+                    memcpy(&preset.values[targetOffsets[s]], values + fileOffsets[s], fileSizes[s] * sizeof(float));
+                }
+                p += fileValueCount * sizeof(float);
+                presets.push_back(preset);
+            }
+            current.setMax(presets.size() - 1);
+            ofLogNotice("PresetBank") << "Loaded " << presets.size() << " presets, " << valueCount << " values each";
+            return true;
+        }
+
+        bool save(){
+            string out;
+            put(out, (uint32_t) PRESET_BANK_MAGIC);
+            put(out, (uint32_t) PRESET_BANK_VERSION);
+            put(out, (uint32_t) slots.size());
+            for (auto & slot : slots) {
+                putString(out, slot.path);
+                put(out, (uint8_t) slot.type);
+            }
+            put(out, (uint32_t) presets.size());
+            for (auto & preset : presets) {
+                putString(out, preset.name);
+                out.append((const char*) &preset.values[0], preset.values.size() * sizeof(float));
+            }
+            return ofBufferToFile(fileName, ofBuffer(out.data(), out.size()), true);
+        }
+
+        // Snapshot the current parameter values as a new preset
+        int store(const string& name=""){
+            Preset preset;
+            preset.name = name.empty() ? "Preset " + ofToString(presets.size()) : name;
+            capture(preset.values);
+            presets.push_back(preset);
+            current.setMax(presets.size() - 1);
+            active = presets.size() - 1;
+            current = active;
+            save();
+            return active;
+        }
+
+        void recall(int index){
+            if (index < 0 || index >= (int) presets.size()) return;
+            bMorphing = false;
+            morphProgress = 0;
+            const vector<float>& values = presets[index].values;
+            for (auto & slot : slots) {
+                writeSlot(slot, &values[slot.offset]);
+            }
+            active = index;
+            current = index;
+        }
+
+        void morphTo(int index){
+            morphTo(index, morphDuration);
+        }
+
+        void morphTo(int index, float duration){
+            if (index < 0 || index >= (int) presets.size()) return;
+            if (duration <= 0) {
+                recall(index);
+                return;
+            }
+            vector<float> from;
+            capture(from);
+            planMorph(from, presets[index].values);
+            morphTarget = index;
+            morphStart = ofGetElapsedTimef();
+            morphLength = duration;
+            bMorphing = true;
+        }
+
+        void update(){
+            if (!bMorphing) return;
+            float t = ofClamp((ofGetElapsedTimef() - morphStart) / morphLength, 0.f, 1.f);
+            float eased = t * t * (3 - 2 * t);
+            applyMorph(eased);
+            morphProgress = t;
+            if (t >= 1) {
+                const vector<float>& values = presets[morphTarget].values;
+                for (auto i : morphSwitches) {
+                    writeSlot(slots[i], &values[slots[i].offset]);
+                }
+                active = morphTarget;
+                current = morphTarget;
+                bMorphing = false;
+            }
+        }
+
+        // Without an active preset stepping forward starts at the first
+        // and stepping back at the last
+        int next(int step) const {
+            if (presets.empty()) return -1;
+            int n = presets.size();
+            int from = active >= 0 ? active : step < 0 ? n : -1;
+            return ((from + step) % n + n) % n;
+        }
+
+        bool isMorphing() const {
+            return bMorphing;
+        }
+        
+        // Bumped whenever any registered value changes
+        uint64_t getRevision() const {
+            return revision;
+        }
+
+        size_t size() const {
+            return presets.size();
+        }
+
+        ofParameterGroup    params;
+        ofParameter<int>    current;
+        ofParameter<float>  morphDuration;
+        ofParameter<float>  morphProgress;
+    };
+}
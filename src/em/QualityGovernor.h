@@ -0,0 +1,138 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Holds a frame time budget by trading quality for speed. The slower
+    // of CPU and GPU frame time is smoothed and compared to the budget:
+    // over it for a while, quality drops one step; well under it for
+    // longer, it comes back one step. The gap between the two thresholds
+    // and the different hold times keep it from oscillating. Each step
+    // changes a single knob, least visible loss first, and every change is
+    // logged with the timings behind it. Recorded frames are never dropped,
+    // so while recording quality can be locked at full.
+    class QualityGovernor {
+
+    public:
+
+        struct Quality {
+            int     samples;        // MSAA samples of the scene fbo
+            int     sphereBias;     // sphere LOD levels skipped
+            int     stepLimit;      // physics steps per frame at most
+            float   lightScale;     // fraction of the enabled lights kept
+            bool    wireframe;      // meshes drawn as wireframe
+        };
+
+    private:
+
+        static vector<Quality> makeLadder(){
+            // samples, sphere bias, steps, lights, wireframe
+            Quality steps[] = {
+                { 4, 0, 8, 1.f,   false },
+                { 2, 0, 8, 1.f,   false },
+                { 2, 1, 8, 1.f,   false },
+                { 0, 1, 8, 1.f,   false },
+                { 0, 1, 8, 0.5f,  false },
+                { 0, 2, 8, 0.5f,  false },
+                { 0, 2, 1, 0.5f,  false },
+                { 0, 2, 1, 0.25f, false },
+                { 0, 3, 1, 0.25f, true  },
+            };
+            return vector<Quality>(begin(steps), end(steps));
+        }
+
+        static string describe(const Quality& from, const Quality& to){
+            string out;
+            auto change = [&](const string& name, const string& a, const string& b){
+                if (a == b) return;
+                if (!out.empty()) out += ", ";
+                out += name + " " + a + " -> " + b;
+            };
+            change("MSAA", ofToString(from.samples), ofToString(to.samples));
+            change("sphere bias", ofToString(from.sphereBias), ofToString(to.sphereBias));
+            change("step limit", ofToString(from.stepLimit), ofToString(to.stepLimit));
+            change("lights", ofToString(from.lightScale), ofToString(to.lightScale));
+            change("wireframe", ofToString(from.wireframe), ofToString(to.wireframe));
+            return out;
+        }
+
+        void setLevel(int newLevel, const string& reason){
+            newLevel = ofClamp(newLevel, 0, (int) ladder.size() - 1);
+            if (newLevel == current) return;
+            ofLogNotice("QualityGovernor") << "level " << current << " -> " << newLevel << " (" << reason
+                                           << "): " << describe(ladder[current], ladder[newLevel]);
+            current = newLevel;
+            level.set(current);
+            overFrames = underFrames = 0;
+            bChanged = true;
+        }
+
+        vector<Quality>     ladder;
+        int                 current;
+        float               smoothed;
+        int                 overFrames, underFrames;
+        bool                bChanged;
+
+    public:
+
+        QualityGovernor(){
+            ladder = makeLadder();
+            current = 0;
+            smoothed = 0;
+            overFrames = underFrames = 0;
+            bChanged = false;
+        }
+
+        void setup(){
+            params.setName("Quality governor");
+            params.add(enabled.set("Adaptive quality", true));
+            params.add(budget.set("Budget ms", 16.6, 4, 100));
+            params.add(lockWhileRecording.set("Full quality recording", true));
+            params.add(cpuTime.set("CPU ms", 0));
+            params.add(gpuTime.set("GPU ms", 0));
+            params.add(level.set("Level", 0));
+        }
+
+        // Once per frame with last frame's timings, true when the quality changed
+        bool update(float cpuMillis, float gpuMillis, bool recording){
+            cpuTime.set(cpuMillis);
+            gpuTime.set(gpuMillis);
+            float frame = max(cpuMillis, gpuMillis);
+            smoothed += (frame - smoothed) * GOVERNOR_SMOOTHING;
+            bChanged = false;
+
+            if (!enabled) {
+                setLevel(0, "disabled");
+            } else if (recording && lockWhileRecording) {
+                setLevel(0, "recording");
+            } else if (smoothed > budget) {
+                underFrames = 0;
+                if (++overFrames >= GOVERNOR_DROP_FRAMES) {
+                    setLevel(current + 1, ofToString(smoothed, 1) + " ms over " + ofToString(budget.get(), 1) + " ms budget, cpu "
+                             + ofToString(cpuMillis, 1) + " gpu " + ofToString(gpuMillis, 1));
+                }
+            } else if (smoothed < budget * GOVERNOR_RAISE_HEADROOM && current > 0) {
+                overFrames = 0;
+                if (++underFrames >= GOVERNOR_RAISE_FRAMES) {
+                    setLevel(current - 1, ofToString(smoothed, 1) + " ms under " + ofToString(budget.get(), 1) + " ms budget");
+                }
+            } else {
+                overFrames = underFrames = 0;
+            }
+            return bChanged;
+        }
+
+        const Quality& getQuality() const {
+            return ladder[current];
+        }
+
+        ofParameterGroup    params;
+        ofParameter<bool>   enabled;
+        ofParameter<float>  budget;
+        ofParameter<bool>   lockWhileRecording;
+        ofParameter<float>  cpuTime, gpuTime;
+        ofParameter<int>    level;
+    };
+}
@@ -4,21 +4,23 @@
 #include "ofxGui.h"
 #include "ofxCameraSaveLoad.h"
 #include "ofxVideoRecorder.h"
+#include "SegmentedRecorder.h"
 #include "Constants.h"
 
 
 namespace em {
     class SceneCamera {
         void setupScreenFbo(){
-            if (!screenFbo.isAllocated()) {
+            if (!screenFbo.isAllocated() || allocatedSamples != fboSamples) {
                 ofFbo::Settings settings;
-                settings.numSamples = 4;
+                settings.numSamples = fboSamples;
                 settings.width = FBO_WIDTH;
                 settings.height = FBO_HEIGHT;
                 settings.internalformat = GL_RGB32F_ARB;
                 settings.useDepth = true;
                 settings.useStencil = true;
                 screenFbo.allocate(settings);
+                allocatedSamples = fboSamples;
             }
             screenFbo.begin();
             ofClear(0,0,0,0);
@@ -38,7 +40,10 @@ namespace em {
         }
         
         ofxVideoRecorder    vidRecorder;
+        SegmentedRecorder   segmentedRecorder;
+        bool                bSegmented;         // backend of the open recording
         ofFbo               screenFbo;
+        int                 fboSamples, allocatedSamples;
         ofFbo               recordFbo;
         ofPixels            recordPixels;
         ofEasyCam           previewCam;
@@ -48,12 +53,18 @@ namespace em {
         
     public:
         
+        SceneCamera(){
+            fboSamples = 4;
+            allocatedSamples = 0;
+        }
+        
         ~SceneCamera(){
             ofRemoveListener(vidRecorder.outputFileCompleteEvent, this, &SceneCamera::recordingComplete);
             camFov.removeListener(this, &SceneCamera::setCamFov);
             camNearClip.removeListener(this, &SceneCamera::setCamNearClip);
             camFarClip.removeListener(this, &SceneCamera::setCamFarClip);
             vidRecorder.close();
+            segmentedRecorder.close();
             ofxSaveCamera(previewCam, "preview_cam_settings");
         }
         
@@ -69,6 +80,16 @@ namespace em {
             camNearClip.addListener(this, &SceneCamera::setCamNearClip);
             camFarClip.addListener(this, &SceneCamera::setCamFarClip);
             
+            // Kept out of params so presets don't switch encoders
+            recordingParams.setName("Recording");
+            recordingParams.add(segmented.set("Segmented encoding", true));
+            recordingParams.add(encoderCount.set("Encoders", max((int) thread::hardware_concurrency() / 2, 1), 1, RECORDER_MAX_ENCODERS));
+            recordingParams.add(segmentFrames.set("Segment frames", 60, 10, 600));
+            recordingParams.add(maxQueuedFrames.set("Max queued frames", 120, 10, 1200));
+            recordingParams.add(ffmpegPath.set("ffmpeg", "/usr/local/bin/ffmpeg"));
+            recordingParams.add(videoCodec.set("Codec", "mpeg4"));
+            recordingParams.add(queuedFrames.set("Queued frames", 0));
+            
             // ffmpeg uses the extension to determine the container type. run 'ffmpeg -formats' to see supported formats
             fileName = "recording";
             fileExt = ".mov";
@@ -78,12 +99,11 @@ namespace em {
             ofxLoadCamera(previewCam, "preview_cam_settings");
             previewCam.setFov(camFov);
             previewCam.lookAt(lookAt);
-            vidRecorder.setVideoCodec("mpeg4");
             vidRecorder.setVideoBitrate("50000k");
-            vidRecorder.setFfmpegLocation("/usr/local/bin/ffmpeg");
             //    vidRecorder.setAudioCodec("mp3");
             //    vidRecorder.setAudioBitrate("192k");
             bRecording = false;
+            bSegmented = false;
             
             setupScreenFbo();
             
@@ -101,11 +121,12 @@ namespace em {
             if (bRecording) {
                 ofPixels pixels;
                 screenFbo.readToPixels(pixels);
-                bool success = vidRecorder.addFrame(pixels);
+                bool success = bSegmented ? segmentedRecorder.addFrame(move(pixels)) : vidRecorder.addFrame(pixels);
                 if (!success) {
                     ofLogWarning("This frame was not added!");
                 }
             }
+            queuedFrames.set(segmentedRecorder.getQueuedFrames());
             // Check if the video recorder encountered any error while writing video frame or audio smaples.
             if (vidRecorder.hasVideoError()) {
                 ofLogWarning("The video recorder failed to write some frames!");
@@ -114,7 +135,15 @@ namespace em {
                 ofLogWarning("The video recorder failed to write some audio samples!");
             }
         }
+        // MSAA samples of the scene fbo, reallocated on the next frame
+        void setSamples(int samples){
+            fboSamples = samples;
+        }
+        int getSamples() const {
+            return fboSamples;
+        }
         void beginScene(){
+            if (allocatedSamples != fboSamples) setupScreenFbo();
             // Render to Fbo
             screenFbo.begin();
             ofClear(0,0,0,0);
@@ -144,31 +173,71 @@ namespace em {
         
         void addAudioSamplesToRecording(float *input, int bufferSize, int nChannels){
             if (bRecording) {
-                vidRecorder.addAudioSamples(input, bufferSize, nChannels);
+                if (bSegmented) segmentedRecorder.addAudioSamples(input, bufferSize, nChannels);
+                else            vidRecorder.addAudioSamples(input, bufferSize, nChannels);
             }
         }
+        const ofCamera& getCamera() const {
+            return previewCam;
+        }
+        // World space ray through a window point, given where the scene is
+        // drawn on screen. False when the point falls outside the scene.
+        bool getRay(float x, float y, const ofRectangle& drawRect, ofVec3f& origin, ofVec3f& dir) const {
+            if (!drawRect.inside(x, y)) return false;
+            ofRectangle viewport(0, 0, FBO_WIDTH, FBO_HEIGHT);
+            float fx = (x - drawRect.x) * FBO_WIDTH / drawRect.width;
+            float fy = (y - drawRect.y) * FBO_HEIGHT / drawRect.height;
+            origin = previewCam.screenToWorld(ofVec3f(fx, fy, -1), viewport);
+            dir = (previewCam.screenToWorld(ofVec3f(fx, fy, 1), viewport) - origin).getNormalized();
+            return true;
+        }
+        void setMouseInputEnabled(bool enabled){
+            if (enabled)    previewCam.enableMouseInput();
+            else            previewCam.disableMouseInput();
+        }
         const bool& isRecording(){
             return bRecording;
         }
         
+        bool isRecorderOpen(){
+            return bSegmented ? segmentedRecorder.isInitialized() : vidRecorder.isInitialized();
+        }
+        
         void toggleRecording(){
             bRecording = !bRecording;
-            if(bRecording && !vidRecorder.isInitialized()) {
-                vidRecorder.setup(fileName+ofGetTimestampString()+fileExt,
-                                  FBO_WIDTH, FBO_HEIGHT,
-                                  60, 44100, 2, false, false);
-                vidRecorder.start();
+            if(bRecording && !isRecorderOpen()) {
+                // The backend is chosen when a recording starts and kept until it ends
+                bSegmented = segmented;
+                string path = fileName+ofGetTimestampString()+fileExt;
+                if (bSegmented) {
+                    SegmentedRecorder::Settings settings;
+                    settings.ffmpegPath = ffmpegPath;
+                    settings.videoCodec = videoCodec;
+                    settings.encoders = encoderCount;
+                    settings.segmentFrames = segmentFrames;
+                    settings.maxQueuedFrames = maxQueuedFrames;
+                    segmentedRecorder.setup(path, settings);
+                } else {
+                    vidRecorder.setVideoCodec(videoCodec);
+                    vidRecorder.setFfmpegLocation(ffmpegPath);
+                    vidRecorder.setup(path,
+                                      FBO_WIDTH, FBO_HEIGHT,
+                                      60, 44100, 2, false, false);
+                    vidRecorder.start();
+                }
             }
-            else if(!bRecording && vidRecorder.isInitialized()) {
+            // Pausing the segmented recorder is just not feeding it frames
+            else if(!bRecording && !bSegmented && vidRecorder.isInitialized()) {
                 vidRecorder.setPaused(true);
             }
-            else if(bRecording && vidRecorder.isInitialized()) {
+            else if(bRecording && !bSegmented && vidRecorder.isInitialized()) {
                 vidRecorder.setPaused(false);
             }
         }
         void endRecording(){
             bRecording = false;
             vidRecorder.close();
+            segmentedRecorder.close();
         }
         
         ofParameterGroup     params;
@@ -176,5 +245,14 @@ namespace em {
         ofParameter<float>   camNearClip;
         ofParameter<float>   camFarClip;
         ofParameter<bool>    orbitCamera;
+        
+        ofParameterGroup     recordingParams;
+        ofParameter<bool>    segmented;
+        ofParameter<int>     encoderCount;
+        ofParameter<int>     segmentFrames;
+        ofParameter<int>     maxQueuedFrames;
+        ofParameter<string>  ffmpegPath;
+        ofParameter<string>  videoCodec;
+        ofParameter<int>     queuedFrames;
     };
 }
\ No newline at end of file
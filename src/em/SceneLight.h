@@ -9,10 +9,24 @@ namespace em {
     protected:
         shared_ptr<ofLight> light;
         
+        // Last values pushed to the light, the switch is tracked on its own
+        // so a light that starts off is not switched off every frame
+        bool                bUploaded;
+        bool                bSwitched;
+        bool                bSuspended;
+        bool                lastEnabled;
+        float               lastBoxSize;
+        ofVec3f             lastAttenuation;
+        ofFloatColor        lastAmbient, lastDiffuse, lastSpecular;
+        
     public:
         
         SceneLight(){
             light = shared_ptr<ofLight>(new ofLight);
+            bUploaded = false;
+            bSwitched = false;
+            lastEnabled = false;
+            bSuspended = false;
         }
         
         void setup(const int& index){
@@ -34,32 +48,66 @@ namespace em {
         }
         
         void update(const float& boxSize){
-            if (enabled) {
-                light->enable();
+            // Only push state to the light when it actually changed
+            bool on = isOn();
+            if (!bSwitched || on != lastEnabled) {
+                if (on) light->enable();
+                else    light->disable();
+                lastEnabled = on;
+                bSwitched = true;
+            }
+            if (!on) return;
+            
+            if (!bUploaded || boxSize != lastBoxSize) {
                 light->setAreaLight(boxSize/2, boxSize/2);
+                lastBoxSize = boxSize;
+            }
+            if (!bUploaded || attConstant != lastAttenuation.x ||
+                attLinear != lastAttenuation.y || attQuadratic != lastAttenuation.z) {
                 light->setAttenuation(attConstant, attLinear, attQuadratic);
+                lastAttenuation.set(attConstant, attLinear, attQuadratic);
+            }
+            if (!bUploaded || ambient.get() != lastAmbient) {
                 light->setAmbientColor(ambient);
+                lastAmbient = ambient;
+            }
+            if (!bUploaded || diffuse.get() != lastDiffuse) {
                 light->setDiffuseColor(diffuse);
+                lastDiffuse = diffuse;
+            }
+            if (!bUploaded || specular.get() != lastSpecular) {
                 light->setSpecularColor(specular);
-                
-                if (orbit) {
-                    float time = ofGetElapsedTimef();
-                    float bs = boxSize / 2;
-                    double s = time * 0.8 * orbitSpeed;
-                    double c = time * 0.4 * orbitSpeed;
-                    float lat = sin(s) * bs;
-                    float lng = cos(c) * bs;
-                    float rad = boxSize * orbitRadius;
-                    light->orbit(lng, lat, rad);
-                }
-                
-            } else {
-                light->disable();
+                lastSpecular = specular;
             }
+            bUploaded = true;
+            
+            if (orbit) {
+                float time = ofGetElapsedTimef();
+                float bs = boxSize / 2;
+                double s = time * 0.8 * orbitSpeed;
+                double c = time * 0.4 * orbitSpeed;
+                float lat = sin(s) * bs;
+                float lng = cos(c) * bs;
+                float rad = boxSize * orbitRadius;
+                light->orbit(lng, lat, rad);
+            }
+        }
+        
+        // Switched off for speed without touching the user's setting
+        void setSuspended(bool suspended){
+            bSuspended = suspended;
+        }
+        
+        bool isOn() const {
+            return enabled && !bSuspended;
+        }
+        
+        ofPoint getPosition() const {
+            return light->getGlobalPosition();
         }
         
         void draw(){
-            if (enabled) light->draw();
+            if (isOn()) light->draw();
         }
         
         void randomiseAmbientColor(){
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Constants.h"
+#include <cstdio>
+
+
+namespace em {
+    // Recording backend that spreads encoding over several ffmpeg
+    // processes. Frames are cut into segments of `segmentFrames`, each
+    // segment is encoded as a single GOP by its own process and segments go
+    // round robin to the encoders, so N encoders keep N segments in flight.
+    // On close the segments are joined with ffmpeg's concat demuxer without
+    // re-encoding and the audio is muxed in. At most `maxQueuedFrames`
+    // frames are held across all encoders, so memory does not grow with
+    // the encoder count, and addFrame blocks when the encoders fall behind
+    // instead of dropping frames. Encoders only overlap on the segments
+    // that fit in that budget.
+    class SegmentedRecorder {
+
+    public:
+
+        struct Settings {
+            string  ffmpegPath      = "ffmpeg";
+            string  videoCodec      = "mpeg4";
+            string  videoBitrate    = "50000k";
+            int     encoders        = 4;
+            int     segmentFrames   = 60;
+            int     maxQueuedFrames = 120;      // across all encoders
+            float   fps             = 60;
+            int     sampleRate      = 44100;
+            int     audioChannels   = 2;
+        };
+
+    private:
+
+        struct Frame {
+            int         segment;
+            ofPixels    pixels;
+        };
+
+        // One ffmpeg process at a time fed from its own queue
+        struct Encoder {
+            thread              worker;
+            mutex               queueMutex;
+            condition_variable  hasFrames;
+            deque<Frame>        queue;
+            bool                closing;
+            atomic<bool>        failed;
+        };
+
+        static string quote(const string& s){
+            string out = "'";
+            for (auto c : s) {
+                if (c == '\'')  out += "'\\''";
+                else            out += c;
+            }
+            return out + "'";
+        }
+
+        string segmentPath(int segment) const {
+            char index[16];
+            snprintf(index, sizeof(index), "_seg%05d", segment);
+            return base + index + extension;
+        }
+
+        FILE* openSegment(int segment, const ofPixels& pixels) const {
+            string cmd = quote(settings.ffmpegPath) + " -y -loglevel error"
+                + " -f rawvideo -pix_fmt " + (pixels.getNumChannels() == 4 ? "rgba" : "rgb24")
+                + " -s " + ofToString(pixels.getWidth()) + "x" + ofToString(pixels.getHeight())
+                + " -r " + ofToString(settings.fps) + " -i -"
+                + " -c:v " + quote(settings.videoCodec) + " -b:v " + quote(settings.videoBitrate)
+                + " -g " + ofToString(settings.segmentFrames)
+                + " " + quote(segmentPath(segment));
+            return popen(cmd.c_str(), "w");
+        }
+
+        void encoderLoop(Encoder& e){
+            FILE* pipe = nullptr;
+            int current = -1;
+            while (true) {
+                Frame frame;
+                {
+                    unique_lock<mutex> lock(e.queueMutex);
+                    e.hasFrames.wait(lock, [&]{ return e.closing || !e.queue.empty(); });
+                    if (e.queue.empty()) break;
+                    frame = move(e.queue.front());
+                    e.queue.pop_front();
+                }
+
+                // A new segment means a new process, the last one is finished off
+                if (frame.segment != current) {
+                    if (pipe && pclose(pipe) != 0) e.failed = true;
+                    pipe = openSegment(frame.segment, frame.pixels);
+                    current = frame.segment;
+                    if (!pipe) e.failed = true;
+                }
+                size_t bytes = frame.pixels.getTotalBytes();
+                if (pipe && fwrite(frame.pixels.getData(), 1, bytes, pipe) != bytes) e.failed = true;
+                frame.pixels.clear();
+
+                // The frame counts against the budget until it is written
+                {
+                    lock_guard<mutex> lock(budgetMutex);
+                    queuedFrames--;
+                }
+                hasBudget.notify_all();
+            }
+            if (pipe && pclose(pipe) != 0) e.failed = true;
+        }
+
+        // Audio arrives on the audio thread and goes to disk from the main thread
+        void flushAudio(){
+            {
+                lock_guard<mutex> lock(audioMutex);
+                audioOut.swap(audioIn);
+            }
+            if (audioFile && !audioOut.empty()) {
+                fwrite(audioOut.data(), sizeof(float), audioOut.size(), audioFile);
+            }
+            audioOut.clear();
+        }
+
+        // Runs on the finisher thread, waits for the encoders to drain
+        void finish(vector<unique_ptr<Encoder>> closing, int segments, bool withAudio){
+            bool failed = false;
+            for (auto & e : closing) {
+                e->worker.join();
+                failed |= e->failed;
+            }
+            if (segments == 0) return;
+            if (failed) ofLogError("SegmentedRecorder") << "an encoder failed, segments are kept in " << base;
+
+            string listPath = base + "_segments.txt";
+            {
+                ofFile list(listPath, ofFile::WriteOnly, true);
+                for (int i = 0; i < segments; i++) list << "file " << quote(segmentPath(i)) << "\n";
+            }
+            string cmd = quote(settings.ffmpegPath) + " -y -loglevel error"
+                + " -f concat -safe 0 -i " + quote(listPath);
+            if (withAudio) {
+                cmd += " -f f32le -ar " + ofToString(settings.sampleRate)
+                    + " -ac " + ofToString(settings.audioChannels) + " -i " + quote(audioPath)
+                    + " -c:a aac";
+            }
+            cmd += " -c:v copy " + quote(outputPath);
+            if (system(cmd.c_str()) != 0) {
+                ofLogError("SegmentedRecorder") << "joining segments failed, they are kept in " << base;
+                return;
+            }
+
+            if (!failed) {
+                for (int i = 0; i < segments; i++) ofFile::removeFile(segmentPath(i), false);
+                ofFile::removeFile(listPath, false);
+                ofFile::removeFile(audioPath, false);
+            }
+            ofLogNotice("SegmentedRecorder") << "recording complete: " << outputPath;
+        }
+
+        Settings                        settings;
+        vector<unique_ptr<Encoder>>     encoders;
+        thread                          finisher;
+        string                          outputPath, base, extension, audioPath;
+        int                             frameCount;
+
+        mutex                           budgetMutex;
+        condition_variable              hasBudget;
+        int                             queuedFrames;
+
+        mutex                           audioMutex;
+        vector<float>                   audioIn, audioOut;
+        FILE*                           audioFile;
+        bool                            hasAudio;
+
+    public:
+
+        SegmentedRecorder(){
+            frameCount = 0;
+            queuedFrames = 0;
+            audioFile = nullptr;
+            hasAudio = false;
+        }
+
+        ~SegmentedRecorder(){
+            close();
+            if (finisher.joinable()) finisher.join();
+        }
+
+        // `path` is the joined output, segments are written next to it
+        bool setup(const string& path, const Settings& s){
+            close();
+            if (finisher.joinable()) finisher.join();
+            settings = s;
+            settings.encoders = ofClamp(settings.encoders, 1, RECORDER_MAX_ENCODERS);
+            settings.segmentFrames = max(settings.segmentFrames, 1);
+            settings.maxQueuedFrames = max(settings.maxQueuedFrames, 1);
+            outputPath = ofToDataPath(path, true);
+            extension = "." + ofFilePath::getFileExt(outputPath);
+            base = outputPath.substr(0, outputPath.size() - extension.size());
+            audioPath = base + "_audio.raw";
+            frameCount = 0;
+            {
+                lock_guard<mutex> lock(audioMutex);
+                audioIn.clear();
+                hasAudio = false;
+            }
+            audioFile = settings.sampleRate > 0 ? fopen(audioPath.c_str(), "wb") : nullptr;
+
+            for (int i = 0; i < settings.encoders; i++) {
+                encoders.push_back(unique_ptr<Encoder>(new Encoder));
+                Encoder& e = *encoders.back();
+                e.closing = false;
+                e.failed = false;
+                e.worker = thread(&SegmentedRecorder::encoderLoop, this, ref(e));
+            }
+            ofLogNotice("SegmentedRecorder") << settings.encoders << " encoders, "
+                                             << settings.segmentFrames << " frames per segment, "
+                                             << settings.maxQueuedFrames << " frames queued at most";
+            return true;
+        }
+
+        bool isInitialized() const {
+            return !encoders.empty();
+        }
+
+        bool addFrame(ofPixels pixels){
+            if (!isInitialized()) return false;
+            flushAudio();
+            int segment = frameCount / settings.segmentFrames;
+            Encoder& e = *encoders[segment % encoders.size()];
+            {
+                unique_lock<mutex> lock(budgetMutex);
+                hasBudget.wait(lock, [&]{ return queuedFrames < settings.maxQueuedFrames; });
+                queuedFrames++;
+            }
+            {
+                lock_guard<mutex> lock(e.queueMutex);
+                Frame frame;
+                frame.segment = segment;
+                e.queue.push_back(move(frame));
+                e.queue.back().pixels = move(pixels);
+            }
+            e.hasFrames.notify_one();
+            frameCount++;
+            return !e.failed;
+        }
+
+        void addAudioSamples(float* samples, int bufferSize, int nChannels){
+            lock_guard<mutex> lock(audioMutex);
+            audioIn.insert(audioIn.end(), samples, samples + bufferSize * nChannels);
+            hasAudio = true;
+        }
+
+        // Frames waiting for or being written by an encoder, across all of them
+        int getQueuedFrames(){
+            lock_guard<mutex> lock(budgetMutex);
+            return queuedFrames;
+        }
+
+        // Returns at once, draining and joining happen in the background
+        void close(){
+            if (!isInitialized()) return;
+            flushAudio();
+            if (audioFile) fclose(audioFile);
+            audioFile = nullptr;
+            bool withAudio;
+            {
+                lock_guard<mutex> lock(audioMutex);
+                withAudio = hasAudio;
+            }
+            for (auto & e : encoders) {
+                {
+                    lock_guard<mutex> lock(e->queueMutex);
+                    e->closing = true;
+                }
+                e->hasFrames.notify_all();
+            }
+            int segments = (frameCount + settings.segmentFrames - 1) / settings.segmentFrames;
+            vector<unique_ptr<Encoder>> closing;
+            closing.swap(encoders);
+            if (finisher.joinable()) finisher.join();
+            finisher = thread(&SegmentedRecorder::finish, this, move(closing), segments, withAudio);
+        }
+    };
+}
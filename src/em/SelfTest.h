@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ofMain.h"
+#include "VisibilityStage.h"
+#include "LightCluster.h"
+#include "MeshGenerator.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Headless correctness checks for the CPU stages that feed drawing.
+    // Every check logs its outcome and the run returns the number of
+    // failures, so it can gate a build. Nothing here touches GL.
+    class SelfTest {
+
+        void expect(bool ok, const string& name){
+            checks++;
+            if (ok) {
+                ofLogNotice("SelfTest") << "ok: " << name;
+            } else {
+                ofLogError("SelfTest") << "failed: " << name;
+                failures++;
+            }
+        }
+
+        // Default camera at the origin looking down -z
+        static ofCamera makeCamera(){
+            ofCamera cam;
+            cam.setFov(60);
+            cam.setNearClip(1);
+            cam.setFarClip(1000);
+            return cam;
+        }
+
+        void testSpringCulling(){
+            VisibilityStage stage;
+            stage.setup();
+            stage.setCamera(makeCamera(), FBO_WIDTH / (float) FBO_HEIGHT);
+
+            // Behind the camera, beyond the far plane and off to the side
+            vector<ofVec3f> lines;
+            for (int i = 0; i < 100; i++) {
+                lines.push_back(ofVec3f(i, 0, 50));
+                lines.push_back(ofVec3f(i, 10, 60));
+                lines.push_back(ofVec3f(i, 0, -2000));
+                lines.push_back(ofVec3f(i, 10, -2500));
+                lines.push_back(ofVec3f(5000, i, -100));
+                lines.push_back(ofVec3f(6000, i, -200));
+            }
+            int numSprings = lines.size() / 2;
+            stage.updateSprings(lines);
+            expect(stage.getSpringIndices().empty(), "springs outside the frustum leave no indices");
+            expect(stage.culledSprings == numSprings, "springs outside the frustum are all counted as culled");
+
+            lines.push_back(ofVec3f(0, 0, -100));
+            lines.push_back(ofVec3f(10, 0, -100));
+            stage.updateSprings(lines);
+            const vector<ofIndexType>& indices = stage.getSpringIndices();
+            expect(indices.size() == 2 && indices[0] == lines.size() - 2 && indices[1] == lines.size() - 1,
+                   "a spring in view is kept");
+        }
+
+        // A 4x2x4 grid over a 90 degree square frustum from 1 to 16, so
+        // tiles split at ndc -0.5, 0, 0.5 and slices at depth 2, 4 and 8
+        void testLightClusters(){
+            LightCluster clusters;
+            clusters.setup(4, 2, 4);
+            vector<ofVec3f> positions;
+            vector<float> radii;
+            // Centered on the x = 0 tile boundary
+            positions.push_back(ofVec3f(0, 0.5, -3));
+            radii.push_back(0.5);
+            // Centered on the depth 8 slice boundary
+            positions.push_back(ofVec3f(-2, -4, -8));
+            radii.push_back(0.1);
+            // Behind the camera
+            positions.push_back(ofVec3f(0, 0, 5));
+            radii.push_back(1);
+            clusters.assign(positions, radii, 90, 1, 1, 16);
+
+            auto holds = [&](int x, int y, int z, unsigned int light){
+                int c = clusters.getClusterIndex(x, y, z);
+                const vector<unsigned int>& indices = clusters.getIndices();
+                return clusters.getCount(c) == 1 && indices[clusters.getOffset(c)] == light;
+            };
+            expect(holds(1, 1, 1, 0) && holds(2, 1, 1, 0), "a light on a tile boundary is in both tiles");
+            expect(holds(1, 0, 2, 1) && holds(1, 0, 3, 1), "a light on a slice boundary is in both slices");
+            expect(clusters.getIndices().size() == 4, "lights outside the frustum are not assigned");
+            expect(clusters.getCount(clusters.getClusterIndex(0, 0, 0)) == 0 &&
+                   clusters.getCount(clusters.getClusterIndex(3, 1, 3)) == 0, "clusters without lights are empty");
+            expect(clusters.findCluster(positions[0], 90, 1) == clusters.getClusterIndex(2, 1, 1),
+                   "findCluster agrees with the assignment");
+        }
+
+        // Paused with threaded physics the drawn snapshot is a step behind
+        // the world, so a change must bump the revision on the frame that
+        // publishes it or the frame cache never shows it
+        void testPausedRevision(){
+            MeshGenerator gen;
+            gen.setup();
+            gen.makeClusterBatch(50, CLUSTER_KNN, 4);
+            gen.threadedPhysics = true;
+            gen.physicsPaused = true;
+            auto frame = [&]{
+                gen.update();
+                gen.waitForPhysics();
+            };
+            frame();
+            frame();
+            bool shown = gen.getDrawnParticleCount() > 1;
+
+            gen.clear();
+            frame();
+            bool stale = gen.getDrawnParticleCount() > 1;
+            uint64_t revision = gen.getRevision();
+            frame();
+            expect(shown && stale && gen.getDrawnParticleCount() == 1,
+                   "a paused threaded world publishes clear() one frame late");
+            expect(gen.getRevision() != revision, "the revision changes on the frame the cleared world is published");
+        }
+
+        int checks, failures;
+
+    public:
+
+        SelfTest(){
+            checks = failures = 0;
+        }
+
+        // True when --self-test is given
+        static bool parseArgs(int argc, char* argv[]){
+            for (int i = 1; i < argc; i++) {
+                if (string(argv[i]) == "--self-test") return true;
+            }
+            return false;
+        }
+
+        // Runs every check, returns the number of failures
+        int run(){
+            checks = failures = 0;
+            testSpringCulling();
+            testLightClusters();
+            testPausedRevision();
+            ofLogNotice("SelfTest") << checks - failures << " of " << checks << " checks passed";
+            return failures;
+        }
+    };
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+namespace em {
+    // One dedicated thread for the physics step so it can overlap drawing.
+    // start() hands over a job and returns at once, wait() blocks until it
+    // has finished. At most one job is in flight; starting another waits
+    // for the previous one first. The thread is created on first use.
+    class SimulationThread {
+
+        void loop(){
+            while (true) {
+                function<void()> fn;
+                {
+                    unique_lock<mutex> lock(stateMutex);
+                    wake.wait(lock, [&]{ return stopping || (bool) job; });
+                    if (!job) return;
+                    fn = job;
+                }
+                fn();
+                {
+                    lock_guard<mutex> lock(stateMutex);
+                    job = nullptr;
+                }
+                done.notify_all();
+            }
+        }
+
+        thread              worker;
+        mutex               stateMutex;
+        condition_variable  wake, done;
+        function<void()>    job;
+        bool                stopping;
+
+    public:
+
+        SimulationThread(){
+            stopping = false;
+        }
+
+        ~SimulationThread(){
+            if (!worker.joinable()) return;
+            {
+                lock_guard<mutex> lock(stateMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        void start(const function<void()>& fn){
+            wait();
+            if (!worker.joinable()) worker = thread(&SimulationThread::loop, this);
+            {
+                lock_guard<mutex> lock(stateMutex);
+                job = fn;
+            }
+            wake.notify_one();
+        }
+
+        void wait(){
+            unique_lock<mutex> lock(stateMutex);
+            done.wait(lock, [&]{ return !job; });
+        }
+    };
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Shared unit spheres at decreasing tessellation. Each particle picks a
+    // level from its projected radius in pixels; anything under a pixel
+    // is drawn as a point instead. Spheres are instanced draws with the
+    // center and radius as a per-instance attribute. Translucent spheres
+    // keep the order they were classified in, so a back to front sort
+    // still blends right: consecutive particles of one level share a draw
+    // and the level changes split it. Opaque ones need no order and go
+    // one draw per level, coarsest first, points last.
+    class SphereLod {
+
+        // Consecutive instances of one level, -1 are points
+        struct Run {
+            int     level;
+            int     first, count;
+        };
+
+        struct Entry {
+            int     level;
+            ofVec4f instance;
+        };
+
+        void append(const Entry& e){
+            int first;
+            if (e.level < 0) {
+                first = pointVerts.size();
+                pointVerts.push_back(ofVec3f(e.instance.x, e.instance.y, e.instance.z));
+            } else {
+                first = instances.size();
+                instances.push_back(e.instance);
+            }
+            if (!runs.empty() && runs.back().level == e.level) runs.back().count++;
+            else runs.push_back(Run{ e.level, first, 1 });
+        }
+
+        // The instance transform needs its own vertex stage. Unless the
+        // caller binds a shader that applies it, the spheres are shaded here
+        // with the material and a light at the camera.
+        void setupShader(){
+            string vert = R"(#version 410
+                uniform mat4 modelViewMatrix;
+                uniform mat4 projectionMatrix;
+                in vec4 position;
+                in vec3 normal;
+                in vec4 instance;
+                out vec3 vViewPosition;
+                out vec3 vViewNormal;
+                void main(){
+                    vec4 view = modelViewMatrix * vec4(instance.xyz + position.xyz * instance.w, 1.0);
+                    vViewPosition = view.xyz;
+                    vViewNormal = mat3(modelViewMatrix) * normal;
+                    gl_Position = projectionMatrix * view;
+                }
+            )";
+            string frag = R"(#version 410
+                uniform vec4 ambientColor;
+                uniform vec4 diffuseColor;
+                uniform vec4 specularColor;
+                uniform float shininess;
+                in vec3 vViewPosition;
+                in vec3 vViewNormal;
+                out vec4 fragColor;
+                void main(){
+                    // Points have no normal and face the camera
+                    vec3 n = dot(vViewNormal, vViewNormal) > 0.0 ? normalize(vViewNormal) : normalize(-vViewPosition);
+                    float facing = max(dot(n, normalize(-vViewPosition)), 0.0);
+                    vec3 lit = diffuseColor.rgb * (ambientColor.rgb + facing)
+                        + specularColor.rgb * pow(facing, max(shininess, 1.0));
+                    fragColor = vec4(lit, diffuseColor.a);
+                }
+            )";
+            shader.setupShaderFromSource(GL_VERTEX_SHADER, vert);
+            shader.setupShaderFromSource(GL_FRAGMENT_SHADER, frag);
+            shader.bindDefaults();
+            shader.bindAttribute(INSTANCE_ATTRIBUTE, "instance");
+            shader.linkProgram();
+        }
+
+        vector<ofVboMesh>   meshes;
+        int                 triangles[SPHERE_LOD_LEVELS];
+        vector<Entry>       entries;
+        vector<ofVec4f>     instances;      // center and radius
+        vector<ofVec3f>     pointVerts;
+        vector<Run>         runs;
+        ofVbo               points;
+        ofShader            shader;
+        int                 detailBias;
+
+    public:
+
+        SphereLod(){
+            detailBias = 0;
+        }
+
+        void setup(){
+            const int resolutions[SPHERE_LOD_LEVELS] = { 48, 24, 12, 6 };
+            meshes.resize(SPHERE_LOD_LEVELS);
+            for (int i = 0; i < SPHERE_LOD_LEVELS; i++) {
+                meshes[i] = ofMesh::sphere(1, resolutions[i], OF_PRIMITIVE_TRIANGLES);
+                size_t n = meshes[i].getNumIndices() ? meshes[i].getNumIndices() : meshes[i].getNumVertices();
+                triangles[i] = n / 3;
+            }
+
+            params.setName("Sphere LOD");
+            params.add(enabled.set("Enabled", true));
+            params.add(pixelThreshold.set("Full detail radius", 48, 4, 256));
+            stats.setName("Stats");
+            for (int i = 0; i < SPHERE_LOD_LEVELS; i++) {
+                stats.add(counts[i].set("LOD " + ofToString(i), 0));
+            }
+            stats.add(pointCount.set("Points", 0));
+            stats.add(culledCount.set("Behind camera", 0));
+            stats.add(triangleCount.set("Triangles", 0));
+            stats.add(drawCount.set("Draw calls", 0));
+            params.add(stats);
+        }
+
+        // Level for a projected radius: each level down covers a quarter of
+        // the pixel radius of the one above, -1 means draw as a point
+        int levelFor(float pixelRadius) const {
+            if (!enabled) return min(detailBias, SPHERE_LOD_LEVELS - 1);
+            float threshold = pixelThreshold;
+            for (int i = 0; i < SPHERE_LOD_LEVELS - 1; i++) {
+                if (pixelRadius >= threshold) return min(i + detailBias, SPHERE_LOD_LEVELS - 1);
+                threshold *= 0.25f;
+            }
+            return pixelRadius >= 1 ? SPHERE_LOD_LEVELS - 1 : -1;
+        }
+
+        // `ordered` keeps the draw order of `order`, needed when the spheres blend
+        void classify(const vector<ofVec3f>& positions, const vector<float>& radii, const vector<uint32_t>& order,
+                      const ofCamera& cam, float viewportHeight, bool ordered){
+            ofMatrix4x4 view = cam.getModelViewMatrix();
+            float projScale = viewportHeight / (2 * tan(cam.getFov() * 0.5f * DEG_TO_RAD));
+
+            entries.clear();
+            instances.clear();
+            pointVerts.clear();
+            runs.clear();
+            int levelCounts[SPHERE_LOD_LEVELS] = { 0 };
+            int culled = 0;
+
+            for (auto i : order) {
+                float r = radii[i];
+                if (r <= 0) continue;
+                const ofVec3f& pos = positions[i];
+                float depth = -(pos * view).z;
+                if (depth + r <= 0) {
+                    culled++;
+                    continue;
+                }
+                float pixelRadius = depth > r ? r * projScale / depth : viewportHeight;
+                int level = levelFor(pixelRadius);
+                entries.push_back(Entry{ level, ofVec4f(pos.x, pos.y, pos.z, r) });
+                if (level >= 0) levelCounts[level]++;
+            }
+
+            if (ordered) {
+                for (auto & e : entries) append(e);
+            } else {
+                for (int level = SPHERE_LOD_LEVELS - 1; level >= -1; level--) {
+                    for (auto & e : entries) {
+                        if (e.level == level) append(e);
+                    }
+                }
+            }
+
+            int total = 0;
+            for (int i = 0; i < SPHERE_LOD_LEVELS; i++) {
+                counts[i].set(levelCounts[i]);
+                total += levelCounts[i] * triangles[i];
+            }
+            pointCount.set(pointVerts.size());
+            culledCount.set(culled);
+            triangleCount.set(total);
+            drawCount.set(runs.size());
+        }
+
+        // Coarser levels for every sphere, 0 is full detail
+        void setDetailBias(int bias){
+            detailBias = max(bias, 0);
+        }
+
+        // With `external` the bound shader must read INSTANCE_ATTRIBUTE as
+        // center and radius. Compiles on first use so setup() needs no GL context
+        void draw(const ofMaterial& material, bool wireframe=false, bool external=false){
+            if (!external) {
+                if (!shader.isLoaded()) setupShader();
+                shader.begin();
+                ofFloatColor a = material.getAmbientColor();
+                ofFloatColor d = material.getDiffuseColor();
+                ofFloatColor s = material.getSpecularColor();
+                shader.setUniform4f("ambientColor", a.r, a.g, a.b, a.a);
+                shader.setUniform4f("diffuseColor", d.r, d.g, d.b, d.a);
+                shader.setUniform4f("specularColor", s.r, s.g, s.b, s.a);
+                shader.setUniform1f("shininess", material.getShininess());
+            }
+            // Points carry no instance attribute, its default of (0, 0, 0, 1) leaves them in place
+            if (!pointVerts.empty()) points.setVertexData(&pointVerts[0], pointVerts.size(), GL_STREAM_DRAW);
+            for (auto & run : runs) {
+                if (run.level < 0) {
+                    points.draw(GL_POINTS, run.first, run.count);
+                    continue;
+                }
+                ofVbo& vbo = meshes[run.level].getVbo();
+                vbo.setAttributeData(INSTANCE_ATTRIBUTE, &instances[run.first].x, 4, run.count, GL_STREAM_DRAW, sizeof(ofVec4f));
+                vbo.setAttributeDivisor(INSTANCE_ATTRIBUTE, 1);
+                meshes[run.level].drawInstanced(wireframe ? OF_MESH_WIREFRAME : OF_MESH_FILL, run.count);
+            }
+            if (!external) shader.end();
+        }
+
+        ofParameterGroup    params;
+        ofParameterGroup    stats;
+        ofParameter<bool>   enabled;
+        ofParameter<float>  pixelThreshold;
+        ofParameter<int>    counts[SPHERE_LOD_LEVELS];
+        ofParameter<int>    pointCount;
+        ofParameter<int>    culledCount;
+        ofParameter<int>    triangleCount;
+        ofParameter<int>    drawCount;
+    };
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofMain.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define EM_SPRING_SSE 1
+#endif
+
+
+namespace em {
+    // Spring endpoints packed as structure of arrays so the tension, color
+    // and width of every spring come out of one vectorised pass. Arrays are
+    // padded to a multiple of 4 and the padding lanes are harmless.
+    class SpringTension {
+
+        static size_t padded(size_t n){
+            return (n + 3) & ~size_t(3);
+        }
+
+        size_t          count;
+        vector<float>   ax, ay, az, bx, by, bz, rest;
+        vector<float>   tension, r, g, b, width;
+
+    public:
+
+        SpringTension(){
+            count = 0;
+        }
+
+        void resize(size_t n){
+            count = n;
+            size_t p = padded(n);
+            vector<float>* arrays[] = { &ax, &ay, &az, &bx, &by, &bz, &tension, &r, &g, &b, &width };
+            for (auto a : arrays) a->resize(p, 0);
+            rest.resize(p, 1);
+        }
+
+        void set(size_t i, const ofVec3f& a, const ofVec3f& e, float restLength){
+            ax[i] = a.x; ay[i] = a.y; az[i] = a.z;
+            bx[i] = e.x; by[i] = e.y; bz[i] = e.z;
+            rest[i] = max(restLength, 0.0001f);
+        }
+
+        // tension = length / rest - 1, mapped to a color blend and line width:
+        // stretched springs fade towards hot, compressed towards cold
+        void compute(const ofFloatColor& base, const ofFloatColor& hot, const ofFloatColor& cold,
+                     float gain, float baseWidth){
+            size_t n = padded(count);
+#ifdef EM_SPRING_SSE
+            const __m128 vGain = _mm_set1_ps(gain);
+            const __m128 vOne = _mm_set1_ps(1.f);
+            const __m128 vZero = _mm_setzero_ps();
+            const __m128 vWidth = _mm_set1_ps(baseWidth);
+            const __m128 baseR = _mm_set1_ps(base.r), baseG = _mm_set1_ps(base.g), baseB = _mm_set1_ps(base.b);
+            const __m128 hotR = _mm_set1_ps(hot.r), hotG = _mm_set1_ps(hot.g), hotB = _mm_set1_ps(hot.b);
+            const __m128 coldR = _mm_set1_ps(cold.r), coldG = _mm_set1_ps(cold.g), coldB = _mm_set1_ps(cold.b);
+            for (size_t i = 0; i < n; i += 4) {
+                __m128 dx = _mm_sub_ps(_mm_loadu_ps(&bx[i]), _mm_loadu_ps(&ax[i]));
+                __m128 dy = _mm_sub_ps(_mm_loadu_ps(&by[i]), _mm_loadu_ps(&ay[i]));
+                __m128 dz = _mm_sub_ps(_mm_loadu_ps(&bz[i]), _mm_loadu_ps(&az[i]));
+                __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+                __m128 t = _mm_sub_ps(_mm_div_ps(len, _mm_loadu_ps(&rest[i])), vOne);
+                _mm_storeu_ps(&tension[i], t);
+
+                __m128 s = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, vGain), _mm_sub_ps(vZero, vOne)), vOne);
+                __m128 stretch = _mm_max_ps(s, vZero);
+                __m128 squash = _mm_max_ps(_mm_sub_ps(vZero, s), vZero);
+                __m128 keep = _mm_sub_ps(vOne, _mm_add_ps(stretch, squash));
+                _mm_storeu_ps(&r[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(baseR, keep), _mm_mul_ps(hotR, stretch)), _mm_mul_ps(coldR, squash)));
+                _mm_storeu_ps(&g[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(baseG, keep), _mm_mul_ps(hotG, stretch)), _mm_mul_ps(coldG, squash)));
+                _mm_storeu_ps(&b[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(baseB, keep), _mm_mul_ps(hotB, stretch)), _mm_mul_ps(coldB, squash)));
+                _mm_storeu_ps(&width[i], _mm_mul_ps(vWidth, _mm_add_ps(vOne, _mm_add_ps(stretch, squash))));
+            }
+#else
+            for (size_t i = 0; i < n; i++) {
+                float dx = bx[i] - ax[i], dy = by[i] - ay[i], dz = bz[i] - az[i];
+                float t = sqrt(dx*dx + dy*dy + dz*dz) / rest[i] - 1;
+                tension[i] = t;
+                float s = ofClamp(t * gain, -1.f, 1.f);
+                float stretch = max(s, 0.f), squash = max(-s, 0.f), keep = 1 - stretch - squash;
+                r[i] = base.r * keep + hot.r * stretch + cold.r * squash;
+                g[i] = base.g * keep + hot.g * stretch + cold.g * squash;
+                b[i] = base.b * keep + hot.b * stretch + cold.b * squash;
+                width[i] = baseWidth * (1 + stretch + squash);
+            }
+#endif
+        }
+
+        size_t size() const { return count; }
+        float getTension(size_t i) const { return tension[i]; }
+        float getWidth(size_t i) const { return width[i]; }
+        ofFloatColor getColor(size_t i, float alpha) const { return ofFloatColor(r[i], g[i], b[i], alpha); }
+    };
+}
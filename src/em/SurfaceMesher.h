@@ -0,0 +1,445 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "WorkerPool.h"
+#include <unordered_map>
+#include "Constants.h"
+
+
+namespace em {
+    // Iso surface of the particle cloud. Particles are splatted as metaballs
+    // into a sparse grid of fixed size blocks and each block is polygonised
+    // by marching cubes on the worker pool. A block is only recomputed when
+    // the quantised particles touching it changed, and since particles are
+    // splatted at their quantised positions an untouched neighbour always
+    // agrees with a recomputed block on their shared face. Vertices on those
+    // faces are merged by global edge id when the blocks are joined, so the
+    // mesh is watertight by index and has one normal per seam vertex.
+    class SurfaceMesher {
+
+        // Samples per block side: the block's corners plus one padding
+        // sample on each side for central difference normals
+        static const int SIDE = SURFACE_BLOCK_CELLS + 3;
+
+        struct Block {
+            int                     bx, by, bz;
+            vector<uint32_t>        members;
+            uint64_t                signature;
+            vector<float>           field;
+            vector<int>             edgeVertex;
+            vector<ofVec3f>         vertices, normals;
+            vector<uint64_t>        seamKeys;       // per vertex, NOT_ON_SEAM inside the block
+            vector<ofIndexType>     indices;
+        };
+
+        static const uint64_t NOT_ON_SEAM = ~0ull;
+
+        struct Splat {
+            ofVec3f     position;
+            float       radius;
+            int32_t     q[3];
+        };
+
+        // Triangulation per corner sign case, edge indices terminated by -1.
+        // Built from per face rules instead of the classic lookup table: on
+        // every face each crossing where the walk leaves the inside is joined
+        // to the next crossing, so two cubes sharing a face always cut it the
+        // same way, ambiguous faces included, and the surface has no cracks.
+        struct CaseTable {
+            int8_t  edgeCorners[12][2];
+            int8_t  triangles[256][SURFACE_MAX_TRIANGLES * 3 + 1];
+
+            CaseTable(){
+                int numEdges = 0;
+                int8_t edgeOf[8][8];
+                for (int a = 0; a < 8; a++) {
+                    for (int axis = 0; axis < 3; axis++) {
+                        int b = a | (1 << axis);
+                        if (b == a) continue;
+                        edgeCorners[numEdges][0] = a;
+                        edgeCorners[numEdges][1] = b;
+                        edgeOf[a][b] = edgeOf[b][a] = numEdges++;
+                    }
+                }
+
+                // Faces as corner cycles, counter clockwise seen from outside
+                int faces[6][4];
+                for (int axis = 0; axis < 3; axis++) {
+                    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                    for (int side = 0; side < 2; side++) {
+                        int* f = faces[axis * 2 + side];
+                        int base = side << axis;
+                        f[0] = base;
+                        f[1] = base | (1 << u);
+                        f[2] = base | (1 << u) | (1 << v);
+                        f[3] = base | (1 << v);
+                        // u x v points along +axis, flip the low side
+                        if (side == 0) swap(f[1], f[3]);
+                    }
+                }
+
+                for (int c = 0; c < 256; c++) {
+                    int next[12];
+                    fill(next, next + 12, -1);
+                    for (int f = 0; f < 6; f++) {
+                        int crossings[4], leaving[4], n = 0;
+                        for (int k = 0; k < 4; k++) {
+                            int a = faces[f][k], b = faces[f][(k + 1) % 4];
+                            bool ina = c >> a & 1, inb = c >> b & 1;
+                            if (ina == inb) continue;
+                            crossings[n] = edgeOf[a][b];
+                            leaving[n++] = ina;
+                        }
+                        for (int k = 0; k < n; k++) {
+                            if (leaving[k]) next[crossings[k]] = crossings[(k + 1) % n];
+                        }
+                    }
+
+                    int8_t* out = triangles[c];
+                    bool used[12] = { false };
+                    for (int e = 0; e < 12; e++) {
+                        if (next[e] < 0 || used[e]) continue;
+                        int loop[12], len = 0;
+                        for (int k = e; !used[k]; k = next[k]) {
+                            used[k] = true;
+                            loop[len++] = k;
+                        }
+                        for (int k = 1; k + 1 < len; k++) {
+                            *out++ = loop[0];
+                            *out++ = loop[k + 1];
+                            *out++ = loop[k];
+                        }
+                    }
+                    *out = -1;
+                }
+            }
+        };
+
+        static const CaseTable& caseTable(){
+            static CaseTable table;
+            return table;
+        }
+
+        static int floorDiv(int a, int b){
+            return a >= 0 ? a / b : -((-a + b - 1) / b);
+        }
+
+        static uint64_t key(int x, int y, int z){
+            return ((uint64_t) (x & 0x1fffff) << 42) | ((uint64_t) (y & 0x1fffff) << 21) | (uint64_t) (z & 0x1fffff);
+        }
+
+        // Global cell edge id, 20 bits per coordinate and 2 for the axis
+        static uint64_t edgeKey(int x, int y, int z, int axis){
+            return ((uint64_t) (x & 0xfffff) << 42) | ((uint64_t) (y & 0xfffff) << 22)
+                | ((uint64_t) (z & 0xfffff) << 2) | (uint64_t) axis;
+        }
+
+        static bool onFace(int v){
+            return v == 1 || v == SURFACE_BLOCK_CELLS + 1;
+        }
+
+        static int sampleIndex(int x, int y, int z){
+            return (z * SIDE + y) * SIDE + x;
+        }
+
+        // Covers the grid and iso level too, so changing them rebuilds
+        // exactly the blocks that end up different
+        uint64_t signatureOf(const Block& block) const {
+            uint64_t h = 1469598103934665603ull;
+            uint32_t grid[2];
+            memcpy(&grid[0], &cellSize, sizeof(float));
+            memcpy(&grid[1], &isoLevel, sizeof(float));
+            for (auto w : grid) h = (h ^ w) * 1099511628211ull;
+            for (auto i : block.members) {
+                const Splat& s = splats[i];
+                uint32_t r;
+                memcpy(&r, &s.radius, sizeof(r));
+                const uint32_t words[4] = { (uint32_t) s.q[0], (uint32_t) s.q[1], (uint32_t) s.q[2], r };
+                for (auto w : words) h = (h ^ w) * 1099511628211ull;
+            }
+            return h;
+        }
+
+        // Metaball field over the padded samples, (1 - d^2/R^2)^3 inside R.
+        // Distances are taken in global sample coordinates so a sample shared
+        // by two blocks comes out bit for bit the same in both.
+        void splat(Block& block) const {
+            block.field.assign(SIDE * SIDE * SIDE, 0.f);
+            int base[3];
+            blockBase(block, base);
+            for (auto i : block.members) {
+                const Splat& s = splats[i];
+                ofVec3f g = s.position / cellSize;
+                float reach = s.radius / cellSize;
+                int lo[3], hi[3];
+                for (int a = 0; a < 3; a++) {
+                    lo[a] = max((int) ceil(g[a] - reach), base[a]);
+                    hi[a] = min((int) floor(g[a] + reach), base[a] + SIDE - 1);
+                }
+                float invR2 = 1.f / (reach * reach);
+                for (int z = lo[2]; z <= hi[2]; z++) {
+                    float dz = z - g.z;
+                    for (int y = lo[1]; y <= hi[1]; y++) {
+                        float dy = y - g.y;
+                        for (int x = lo[0]; x <= hi[0]; x++) {
+                            float dx = x - g.x;
+                            float q = 1 - (dx*dx + dy*dy + dz*dz) * invR2;
+                            if (q > 0) block.field[sampleIndex(x - base[0], y - base[1], z - base[2])] += q * q * q;
+                        }
+                    }
+                }
+            }
+        }
+
+        ofVec3f gradient(const Block& block, int x, int y, int z) const {
+            const vector<float>& f = block.field;
+            return ofVec3f(f[sampleIndex(x + 1, y, z)] - f[sampleIndex(x - 1, y, z)],
+                           f[sampleIndex(x, y + 1, z)] - f[sampleIndex(x, y - 1, z)],
+                           f[sampleIndex(x, y, z + 1)] - f[sampleIndex(x, y, z - 1)]);
+        }
+
+        // Shared vertex on the cell edge leaving sample (x, y, z) along `axis`
+        int edgeVertex(Block& block, int x, int y, int z, int axis, const int* base){
+            int slot = sampleIndex(x, y, z) * 3 + axis;
+            if (block.edgeVertex[slot] >= 0) return block.edgeVertex[slot];
+            int x1 = x + (axis == 0), y1 = y + (axis == 1), z1 = z + (axis == 2);
+            float f0 = block.field[sampleIndex(x, y, z)];
+            float f1 = block.field[sampleIndex(x1, y1, z1)];
+            float t = ofClamp((isoLevel - f0) / (f1 - f0), 0.f, 1.f);
+            ofVec3f p0(base[0] + x, base[1] + y, base[2] + z);
+            ofVec3f p1(base[0] + x1, base[1] + y1, base[2] + z1);
+            block.vertices.push_back(p0.getInterpolated(p1, t) * cellSize);
+            ofVec3f g = gradient(block, x, y, z).getInterpolated(gradient(block, x1, y1, z1), t);
+            block.normals.push_back(-g.getNormalized());
+            // Edges lying in a face of the block are shared with the neighbour
+            bool seam = (axis != 0 && onFace(x)) || (axis != 1 && onFace(y)) || (axis != 2 && onFace(z));
+            block.seamKeys.push_back(seam ? edgeKey(base[0] + x, base[1] + y, base[2] + z, axis) : NOT_ON_SEAM);
+            return block.edgeVertex[slot] = block.vertices.size() - 1;
+        }
+
+        void polygonise(Block& block){
+            const CaseTable& table = caseTable();
+            int base[3];
+            blockBase(block, base);
+            block.vertices.clear();
+            block.normals.clear();
+            block.seamKeys.clear();
+            block.indices.clear();
+            block.edgeVertex.assign(SIDE * SIDE * SIDE * 3, -1);
+            for (int z = 1; z <= SURFACE_BLOCK_CELLS; z++) {
+                for (int y = 1; y <= SURFACE_BLOCK_CELLS; y++) {
+                    for (int x = 1; x <= SURFACE_BLOCK_CELLS; x++) {
+                        int c = 0;
+                        for (int k = 0; k < 8; k++) {
+                            if (block.field[sampleIndex(x + (k & 1), y + (k >> 1 & 1), z + (k >> 2 & 1))] > isoLevel) c |= 1 << k;
+                        }
+                        if (c == 0 || c == 255) continue;
+                        for (const int8_t* e = table.triangles[c]; *e >= 0; e++) {
+                            int a = table.edgeCorners[*e][0], b = table.edgeCorners[*e][1];
+                            int axis = (a ^ b) == 1 ? 0 : (a ^ b) == 2 ? 1 : 2;
+                            block.indices.push_back(edgeVertex(block, x + (a & 1), y + (a >> 1 & 1), z + (a >> 2 & 1), axis, base));
+                        }
+                    }
+                }
+            }
+        }
+
+        // Global sample coordinates of sample (0, 0, 0), one cell outside the block
+        void blockBase(const Block& block, int* base) const {
+            base[0] = block.bx * SURFACE_BLOCK_CELLS - 1;
+            base[1] = block.by * SURFACE_BLOCK_CELLS - 1;
+            base[2] = block.bz * SURFACE_BLOCK_CELLS - 1;
+        }
+
+        unordered_map<uint64_t, Block>  blocks;
+        vector<Block*>                  live;
+        unordered_map<uint64_t, ofIndexType>    seamVertices;
+        vector<ofIndexType>             remap;
+        vector<Splat>                   splats;
+        vector<uint8_t>                 rebuilt;
+        float                           cellSize;
+        float                           isoLevel;
+        float                           quantum;
+        ofFloatColor                    lastColor;
+        int                             numBlocks, numDirty, numTriangles;
+
+    public:
+
+        // Plain copy of the parameters the step reads, see getSettings()
+        struct Settings {
+            bool    enabled;
+            float   blobScale, resolution, iso;
+        };
+
+        SurfaceMesher(){
+            cellSize = 1;
+            isoLevel = 0.5f;
+            quantum = 1;
+            numBlocks = numDirty = numTriangles = 0;
+        }
+
+        void setup(){
+            params.setName("Surface");
+            params.add(enabled.set("Marching cubes", false));
+            params.add(blobScale.set("Blob scale", 3, 1, 8));
+            params.add(resolution.set("Cells per blob", 2, 0.5, 8));
+            params.add(iso.set("Iso level", 0.3, 0.01, 1));
+            stats.setName("Stats");
+            stats.add(blockCount.set("Blocks", 0));
+            stats.add(dirtyCount.set("Dirty blocks", 0));
+            stats.add(triangleCount.set("Surface triangles", 0));
+            params.add(stats);
+        }
+
+        // Rebuilds changed blocks; returns true when `mesh` was rewritten
+        template <typename T>
+        bool update(msa::physics::WorldT<T>& physics, const Settings& settings, ofMesh& mesh,
+                    const ofFloatColor& color, WorkerPool& pool=WorkerPool::shared()){
+            size_t n = physics.numberOfParticles();
+            float maxRadius = 0;
+            splats.clear();
+            for (size_t i = 0; i < n; i++) {
+                auto p = physics.getParticle(i);
+                if (p->getRadius() <= 0) continue;
+                Splat s;
+                s.position = p->getPosition();
+                s.radius = p->getRadius() * settings.blobScale;
+                splats.push_back(s);
+                maxRadius = max(maxRadius, s.radius);
+            }
+
+            // The cell size snaps to quarter octaves, so the grid only moves
+            // when the largest particle changes size noticeably
+            float newCellSize = max(maxRadius / settings.resolution, 0.01f);
+            cellSize = pow(2.f, round(log2(newCellSize) * 4) / 4);
+            isoLevel = settings.iso;
+            quantum = cellSize / 32;
+
+            for (auto & b : blocks) b.second.members.clear();
+            for (uint32_t i = 0; i < splats.size(); i++) {
+                Splat& s = splats[i];
+                for (int a = 0; a < 3; a++) {
+                    s.q[a] = (int32_t) floor(s.position[a] / quantum + 0.5f);
+                    s.position[a] = s.q[a] * quantum;
+                }
+                int lo[3], hi[3];
+                for (int a = 0; a < 3; a++) {
+                    int first = floor((s.position[a] - s.radius) / cellSize);
+                    int last = ceil((s.position[a] + s.radius) / cellSize);
+                    lo[a] = floorDiv(first - 2, SURFACE_BLOCK_CELLS);
+                    hi[a] = floorDiv(last + 1, SURFACE_BLOCK_CELLS);
+                }
+                for (int z = lo[2]; z <= hi[2]; z++) {
+                    for (int y = lo[1]; y <= hi[1]; y++) {
+                        for (int x = lo[0]; x <= hi[0]; x++) {
+                            Block& block = blocks[key(x, y, z)];
+                            if (block.field.empty() && block.members.empty()) {
+                                block.bx = x; block.by = y; block.bz = z;
+                                block.signature = 0;
+                            }
+                            block.members.push_back(i);
+                        }
+                    }
+                }
+            }
+
+            bool changed = false;
+            live.clear();
+            for (auto it = blocks.begin(); it != blocks.end(); ) {
+                if (it->second.members.empty()) {
+                    it = blocks.erase(it);
+                    changed = true;
+                } else {
+                    live.push_back(&it->second);
+                    ++it;
+                }
+            }
+
+            rebuilt.assign(live.size(), 0);
+            pool.parallelFor(live.size(), 4, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    Block& block = *live[i];
+                    uint64_t signature = signatureOf(block);
+                    if (signature == block.signature && !block.field.empty()) continue;
+                    block.signature = signature;
+                    splat(block);
+                    polygonise(block);
+                    rebuilt[i] = 1;
+                }
+            });
+            int dirty = count(rebuilt.begin(), rebuilt.end(), 1);
+            numBlocks = live.size();
+            numDirty = dirty;
+            if (!changed && dirty == 0 && mesh.getMode() == OF_PRIMITIVE_TRIANGLES) {
+                if (color == lastColor) return false;
+                mesh.getColors().assign(mesh.getNumVertices(), color);
+                lastColor = color;
+                return true;
+            }
+
+            mesh.clear();
+            mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+            seamVertices.clear();
+            vector<ofVec3f>& vertices = mesh.getVertices();
+            vector<ofVec3f>& normals = mesh.getNormals();
+            vector<ofIndexType>& indices = mesh.getIndices();
+            for (auto block : live) {
+                remap.resize(block->vertices.size());
+                for (size_t v = 0; v < block->vertices.size(); v++) {
+                    uint64_t seamKey = block->seamKeys[v];
+                    if (seamKey != NOT_ON_SEAM) {
+                        auto found = seamVertices.find(seamKey);
+                        if (found != seamVertices.end()) {
+                            remap[v] = found->second;
+                            continue;
+                        }
+                        seamVertices[seamKey] = vertices.size();
+                    }
+                    remap[v] = vertices.size();
+                    vertices.push_back(block->vertices[v]);
+                    normals.push_back(block->normals[v]);
+                }
+                for (auto i : block->indices) indices.push_back(remap[i]);
+            }
+            mesh.getColors().assign(mesh.getNumVertices(), color);
+            lastColor = color;
+            numTriangles = mesh.getNumIndices() / 3;
+            return true;
+        }
+
+        // Read on the main thread, the step only sees the copy
+        Settings getSettings() const {
+            Settings s;
+            s.enabled = enabled;
+            s.blobScale = blobScale;
+            s.resolution = resolution;
+            s.iso = iso;
+            return s;
+        }
+
+        // Counters go to the gui from the main thread, never from the step
+        void publishStats(){
+            blockCount.set(numBlocks);
+            dirtyCount.set(numDirty);
+            triangleCount.set(numTriangles);
+        }
+
+        void clear(){
+            blocks.clear();
+            live.clear();
+            seamVertices.clear();
+            numBlocks = numDirty = numTriangles = 0;
+        }
+
+        ofParameterGroup    params;
+        ofParameterGroup    stats;
+        ofParameter<bool>   enabled;
+        ofParameter<float>  blobScale;
+        ofParameter<float>  resolution;
+        ofParameter<float>  iso;
+        ofParameter<int>    blockCount;
+        ofParameter<int>    dirtyCount;
+        ofParameter<int>    triangleCount;
+    };
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+#include <random>
+#include <unordered_map>
+
+
+namespace em {
+    // Headless parameter sweep. Every instance owns its own physics world
+    // and random engine, draws its parameters from the same ranges as
+    // MeshGenerator::randomiseParams and grows a cluster the way
+    // MeshGenerator::makeCluster does, with no rendering at all. Instances
+    // run across the worker pool and their summary metrics go to a CSV file;
+    // the best settled candidates can be written out as PLY snapshots.
+    // Instance i uses seed + i, so any row is reproduced by rerunning a
+    // single instance with that row's seed.
+    class SweepRunner {
+
+    public:
+
+        struct Settings {
+            int         instances       = 256;
+            int         steps           = 2000;
+            int         growEvery       = 10;
+            int         maxParticles    = 200;
+            uint32_t    seed            = 1;
+            float       boxSize         = 100;
+            float       settleEnergy    = 0.01f;
+            bool        bindToCenter    = true;
+            int         snapshots       = 0;
+            string      csvPath         = "sweep.csv";
+            string      snapshotPrefix  = "sweep_best_";
+        };
+
+    private:
+
+        struct Result {
+            uint32_t    seed;
+            double      radius, mass, bounce, attraction, springStrength, springLength;
+            int         particles, springs;
+            double      energy, bounds;
+            int         settleStep;             // -1 when still moving at the end
+            double      stepMicros;
+            vector<ofVec3f>                     positions;
+            vector<pair<uint32_t, uint32_t>>    edges;
+        };
+
+        static double kineticEnergy(msa::physics::World3D& physics){
+            double e = 0;
+            for (int i = 0; i < physics.numberOfParticles(); i++) {
+                auto p = physics.getParticle(i);
+                if (p->isFixed()) continue;
+                e += 0.5 * p->getMass() * p->getVelocity().lengthSquared();
+            }
+            return e;
+        }
+
+        static void simulate(const Settings& settings, uint32_t seed, Result& r){
+            mt19937 rng(seed);
+            uniform_real_distribution<double> unit(0, 1);
+            auto range = [&](double lo, double hi){ return lo + (hi - lo) * unit(rng); };
+
+            r.seed = seed;
+            r.radius = range(PARTICLE_MIN_RADIUS, PARTICLE_MAX_RADIUS);
+            r.mass = range(MIN_MASS, MAX_MASS);
+            r.bounce = range(MIN_BOUNCE, MAX_BOUNCE);
+            r.attraction = range(MIN_ATTRACTION, MAX_ATTRACTION);
+            r.springStrength = range(SPRING_MIN_STRENGTH, SPRING_MAX_STRENGTH);
+            r.springLength = range(SPRING_MIN_LENGTH, SPRING_MAX_LENGTH);
+
+            // Declared before the world so the world lets go of it first
+            msa::physics::Particle3D center;
+            msa::physics::World3D physics;
+            physics.setSectorCount(SECTOR_COUNT);
+            physics.setTimeStep(60);
+            physics.setDrag(0.97f);
+            physics.disableCollision();
+            float s = settings.boxSize;
+            physics.setWorldSize(ofVec3f(-s, -s, -s), ofVec3f(s, s, s));
+            physics.addParticle(&center);
+            center.setMass(1)->setRadius(10.f)->moveTo(ofPoint::zero())->makeFixed();
+
+            vector<msa::physics::Particle3D*> added;
+            double micros = 0;
+            int lastMoving = -1;
+            int lastGrowth = 0;
+            float extent = s * 0.8f;
+            for (int step = 0; step < settings.steps; step++) {
+                if (step % max(settings.growEvery, 1) == 0 && (int) added.size() < settings.maxParticles) {
+                    auto a = new msa::physics::Particle3D;
+                    a->setMass(r.mass)
+                    ->setBounce(r.bounce)
+                    ->setRadius(r.radius)
+                    ->makeFree()
+                    ->moveTo(ofPoint(range(-extent, extent), range(-extent, extent), range(-extent, extent)));
+                    physics.addParticle(a);
+                    a->release();
+                    if (r.attraction > 0) physics.makeAttraction(a, &center, r.attraction);
+                    if (!added.empty()) {
+                        physics.makeSpring(added.back(), a, r.springStrength, r.springLength);
+                        if (settings.bindToCenter && added.size() % 2 == 0) {
+                            physics.makeSpring(a, &center, r.springStrength, r.springLength);
+                        }
+                    }
+                    added.push_back(a);
+                    lastGrowth = step;
+                }
+
+                auto t0 = chrono::steady_clock::now();
+                physics.update();
+                micros += chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count();
+
+                r.energy = kineticEnergy(physics);
+                if (r.energy > settings.settleEnergy || step == lastGrowth) lastMoving = step;
+            }
+
+            r.particles = added.size();
+            r.springs = physics.numberOfSprings();
+            r.settleStep = lastMoving + 1 < settings.steps ? lastMoving + 1 : -1;
+            r.stepMicros = settings.steps > 0 ? micros / settings.steps : 0;
+
+            float big = numeric_limits<float>::max();
+            ofVec3f lo(big, big, big), hi(-big, -big, -big);
+            for (auto a : added) {
+                const ofVec3f& p = a->getPosition();
+                lo.set(min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z));
+                hi.set(max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z));
+            }
+            r.bounds = added.empty() ? 0 : lo.distance(hi);
+
+            if (settings.snapshots > 0) {
+                r.positions.clear();
+                r.edges.clear();
+                unordered_map<void*, uint32_t> indexOf;
+                for (int i = 0; i < physics.numberOfParticles(); i++) {
+                    auto p = physics.getParticle(i);
+                    indexOf[p] = r.positions.size();
+                    r.positions.push_back(p->getPosition());
+                }
+                for (int i = 0; i < physics.numberOfSprings(); i++) {
+                    auto spring = physics.getSpring(i);
+                    r.edges.push_back(make_pair(indexOf[spring->getOneEnd()], indexOf[spring->getTheOtherEnd()]));
+                }
+            }
+        }
+
+        // Settled runs first, quickest to settle, then calmest
+        static bool better(const Result& a, const Result& b){
+            if ((a.settleStep < 0) != (b.settleStep < 0)) return a.settleStep >= 0;
+            if (a.settleStep != b.settleStep) return a.settleStep < b.settleStep;
+            return a.energy < b.energy;
+        }
+
+        void writeCsv(const Settings& settings){
+            ofFile file(settings.csvPath, ofFile::WriteOnly);
+            file << "seed,radius,mass,bounce,attraction,spring_strength,spring_length,"
+                 << "particles,springs,final_energy,bounding_size,settle_step,step_us\n";
+            for (auto & r : results) {
+                file << r.seed << ',' << r.radius << ',' << r.mass << ',' << r.bounce << ','
+                     << r.attraction << ',' << r.springStrength << ',' << r.springLength << ','
+                     << r.particles << ',' << r.springs << ',' << r.energy << ',' << r.bounds << ','
+                     << r.settleStep << ',' << r.stepMicros << '\n';
+            }
+        }
+
+        void writeSnapshots(const Settings& settings){
+            vector<const Result*> ranked;
+            for (auto & r : results) ranked.push_back(&r);
+            sort(ranked.begin(), ranked.end(), [](const Result* a, const Result* b){ return better(*a, *b); });
+            for (int i = 0; i < min(settings.snapshots, (int) ranked.size()); i++) {
+                const Result& r = *ranked[i];
+                ofMesh mesh;
+                mesh.setMode(OF_PRIMITIVE_LINES);
+                mesh.addVertices(r.positions);
+                for (auto & e : r.edges) {
+                    mesh.addIndex(e.first);
+                    mesh.addIndex(e.second);
+                }
+                string path = settings.snapshotPrefix + ofToString(i) + "_seed" + ofToString(r.seed) + ".ply";
+                mesh.save(path);
+                ofLogNotice("SweepRunner") << "saved " << path;
+            }
+        }
+
+        vector<Result>  results;
+
+    public:
+
+        // Reads --sweep <instances> and its options, false when not a sweep run
+        static bool parseArgs(int argc, char* argv[], Settings& settings){
+            bool sweep = false;
+            for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                bool hasValue = i + 1 < argc;
+                if (arg == "--sweep") {
+                    sweep = true;
+                    if (hasValue && isdigit(argv[i + 1][0])) settings.instances = ofToInt(argv[++i]);
+                }
+                else if (arg == "--steps" && hasValue)      settings.steps = ofToInt(argv[++i]);
+                else if (arg == "--grow-every" && hasValue) settings.growEvery = ofToInt(argv[++i]);
+                else if (arg == "--particles" && hasValue)  settings.maxParticles = ofToInt(argv[++i]);
+                else if (arg == "--seed" && hasValue)       settings.seed = ofToInt(argv[++i]);
+                else if (arg == "--box" && hasValue)        settings.boxSize = ofToFloat(argv[++i]);
+                else if (arg == "--settle" && hasValue)     settings.settleEnergy = ofToFloat(argv[++i]);
+                else if (arg == "--best" && hasValue)       settings.snapshots = ofToInt(argv[++i]);
+                else if (arg == "--out" && hasValue)        settings.csvPath = argv[++i];
+            }
+            return sweep;
+        }
+
+        void run(const Settings& settings, WorkerPool& pool=WorkerPool::shared()){
+            results.assign(max(settings.instances, 0), Result());
+            atomic<int> finished(0);
+            int progressStep = max((int) results.size() / 20, 1);
+            ofLogNotice("SweepRunner") << results.size() << " instances, " << settings.steps
+                                       << " steps each on " << pool.size() << " threads";
+            auto start = chrono::steady_clock::now();
+
+            pool.parallelFor(results.size(), 1, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    simulate(settings, settings.seed + i, results[i]);
+                    int done = ++finished;
+                    if (done % progressStep == 0) {
+                        ofLogNotice("SweepRunner") << done << "/" << results.size();
+                    }
+                }
+            });
+
+            writeCsv(settings);
+            if (settings.snapshots > 0) writeSnapshots(settings);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            ofLogNotice("SweepRunner") << "done in " << seconds << "s, results in " << settings.csvPath;
+        }
+    };
+}
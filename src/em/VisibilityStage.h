@@ -0,0 +1,212 @@
+#pragma once
+
+#include "ofMain.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+
+
+namespace em {
+    // Per frame visibility for translucent geometry: particles and springs
+    // are culled against the camera frustum in view space, the survivors are
+    // ordered back to front by a parallel LSD radix sort on quantised depth
+    // and handed out as compact index lists.
+    class VisibilityStage {
+
+        struct Frustum {
+            float tanX, tanY, secX, secY, nearClip, farClip;
+        };
+
+        // Signed distance outside the frustum (<= 0 inside) per plane is
+        // tested against the radius, conservative at the corners
+        bool sphereVisible(const ofVec3f& v, float r) const {
+            float d = -v.z;
+            if (d < frustum.nearClip - r || d > frustum.farClip + r) return false;
+            if (fabs(v.x) - d * frustum.tanX > r * frustum.secX) return false;
+            if (fabs(v.y) - d * frustum.tanY > r * frustum.secY) return false;
+            return true;
+        }
+
+        // Outcode with one bit per plane, a segment is culled only when
+        // both ends are outside the same plane
+        int outcode(const ofVec3f& v) const {
+            float d = -v.z;
+            int code = 0;
+            if (d < frustum.nearClip)           code |= 1;
+            if (d > frustum.farClip)            code |= 2;
+            if (v.x >  d * frustum.tanX)        code |= 4;
+            if (v.x < -d * frustum.tanX)        code |= 8;
+            if (v.y >  d * frustum.tanY)        code |= 16;
+            if (v.y < -d * frustum.tanY)        code |= 32;
+            return code;
+        }
+
+        // Larger depth gets a smaller key so an ascending sort is back to front
+        uint32_t depthKey(float depth) const {
+            const uint32_t maxKey = (1u << VISIBILITY_DEPTH_BITS) - 1;
+            float t = ofClamp(depth / frustum.farClip, 0.f, 1.f);
+            return maxKey - (uint32_t) (t * maxKey);
+        }
+
+        // Stable LSD radix sort of (key, value) pairs, 8 bits per pass
+        void radixSort(vector<uint32_t>& keys, vector<uint32_t>& values, WorkerPool& pool){
+            size_t n = keys.size();
+            if (n < 2) return;
+            int parts = pool.size();
+            size_t span = (n + parts - 1) / parts;
+            keysTmp.resize(n);
+            valuesTmp.resize(n);
+            histograms.resize(parts * 256);
+
+            for (int shift = 0; shift < VISIBILITY_DEPTH_BITS; shift += 8) {
+                pool.parallelFor(parts, 1, [&](size_t begin, size_t end, int){
+                    for (size_t p = begin; p < end; p++) {
+                        uint32_t* hist = &histograms[p * 256];
+                        fill(hist, hist + 256, 0);
+                        for (size_t i = p * span; i < min(n, (p + 1) * span); i++) {
+                            hist[(keys[i] >> shift) & 0xff]++;
+                        }
+                    }
+                });
+                uint32_t offset = 0;
+                for (int bucket = 0; bucket < 256; bucket++) {
+                    for (int p = 0; p < parts; p++) {
+                        uint32_t count = histograms[p * 256 + bucket];
+                        histograms[p * 256 + bucket] = offset;
+                        offset += count;
+                    }
+                }
+                pool.parallelFor(parts, 1, [&](size_t begin, size_t end, int){
+                    for (size_t p = begin; p < end; p++) {
+                        uint32_t* cursor = &histograms[p * 256];
+                        for (size_t i = p * span; i < min(n, (p + 1) * span); i++) {
+                            uint32_t dst = cursor[(keys[i] >> shift) & 0xff]++;
+                            keysTmp[dst] = keys[i];
+                            valuesTmp[dst] = values[i];
+                        }
+                    }
+                });
+                keys.swap(keysTmp);
+                values.swap(valuesTmp);
+            }
+        }
+
+        Frustum                 frustum;
+        ofMatrix4x4             view;
+
+        vector<ofVec3f>         viewPositions;
+        vector<float>           radii;
+        vector<uint8_t>         visibleFlags;
+        vector<uint32_t>        keys, values, keysTmp, valuesTmp;
+        vector<uint32_t>        histograms;
+
+        vector<uint32_t>        particleOrder;
+        vector<ofIndexType>     springIndices;
+
+    public:
+
+        void setup(){
+            params.setName("Visibility");
+            params.add(enabled.set("Cull and sort", true));
+            stats.setName("Stats");
+            stats.add(visibleParticles.set("Visible particles", 0));
+            stats.add(culledParticles.set("Culled particles", 0));
+            stats.add(visibleSprings.set("Visible springs", 0));
+            stats.add(culledSprings.set("Culled springs", 0));
+            params.add(stats);
+        }
+
+        void setCamera(const ofCamera& cam, float aspect){
+            view = cam.getModelViewMatrix();
+            frustum.tanY = tan(cam.getFov() * 0.5f * DEG_TO_RAD);
+            frustum.tanX = frustum.tanY * aspect;
+            frustum.secX = sqrt(1 + frustum.tanX * frustum.tanX);
+            frustum.secY = sqrt(1 + frustum.tanY * frustum.tanY);
+            frustum.nearClip = cam.getNearClip();
+            frustum.farClip = max(cam.getFarClip(), frustum.nearClip + 1);
+        }
+
+        // Visible indices into the particle snapshot, farthest first.
+        // A radius of 0 marks a particle that is not drawn.
+        void updateParticles(const vector<ofVec3f>& positions, const vector<float>& particleRadii,
+                             WorkerPool& pool=WorkerPool::shared()){
+            size_t n = positions.size();
+            viewPositions.resize(n);
+            radii.resize(n);
+            visibleFlags.resize(n);
+            pool.parallelFor(n, 512, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    float r = particleRadii[i];
+                    viewPositions[i] = positions[i] * view;
+                    radii[i] = r;
+                    visibleFlags[i] = r > 0 && (!enabled || sphereVisible(viewPositions[i], r));
+                }
+            });
+
+            keys.clear();
+            values.clear();
+            int culled = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (radii[i] <= 0) continue;
+                if (!visibleFlags[i]) {
+                    culled++;
+                    continue;
+                }
+                keys.push_back(depthKey(-viewPositions[i].z));
+                values.push_back(i);
+            }
+            if (enabled) radixSort(keys, values, pool);
+            particleOrder.swap(values);
+
+            visibleParticles.set(particleOrder.size());
+            culledParticles.set(culled);
+        }
+
+        // Line list vertices, two per spring; fills the index list that
+        // draws only visible springs, farthest first
+        void updateSprings(const vector<ofVec3f>& lineVerts, WorkerPool& pool=WorkerPool::shared()){
+            size_t numSprings = lineVerts.size() / 2;
+            keys.resize(numSprings);
+            visibleFlags.resize(numSprings);
+            pool.parallelFor(numSprings, 512, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    ofVec3f a = lineVerts[i*2] * view;
+                    ofVec3f b = lineVerts[i*2+1] * view;
+                    visibleFlags[i] = !enabled || (outcode(a) & outcode(b)) == 0;
+                    keys[i] = depthKey(-(a.z + b.z) * 0.5f);
+                }
+            });
+
+            size_t visible = 0;
+            values.clear();
+            for (size_t i = 0; i < numSprings; i++) {
+                if (!visibleFlags[i]) continue;
+                keys[visible++] = keys[i];
+                values.push_back(i);
+            }
+            keys.resize(visible);
+            if (enabled) radixSort(keys, values, pool);
+
+            springIndices.resize(visible * 2);
+            for (size_t i = 0; i < visible; i++) {
+                springIndices[i*2] = values[i] * 2;
+                springIndices[i*2+1] = values[i] * 2 + 1;
+            }
+            visibleSprings.set(visible);
+            culledSprings.set(numSprings - visible);
+        }
+
+        const vector<uint32_t>& getParticleOrder() const {
+            return particleOrder;
+        }
+
+        const vector<ofIndexType>& getSpringIndices() const {
+            return springIndices;
+        }
+
+        ofParameterGroup    params;
+        ofParameterGroup    stats;
+        ofParameter<bool>   enabled;
+        ofParameter<int>    visibleParticles, culledParticles;
+        ofParameter<int>    visibleSprings, culledSprings;
+    };
+}
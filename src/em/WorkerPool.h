@@ -0,0 +1,115 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+namespace em {
+    // Persistent worker threads for data parallel loops. parallelFor splits
+    // [0, count) into chunks of `grain`, the calling thread works along and
+    // the call returns once every chunk ran. Jobs get the index of the
+    // worker running them (0 is the caller) to address per-worker scratch.
+    // A parallelFor issued while another one is in flight runs inline.
+    class WorkerPool {
+
+    public:
+        typedef function<void(size_t begin, size_t end, int worker)> Job;
+
+    private:
+
+        void workerLoop(int id){
+            uint64_t seen = 0;
+            while (true) {
+                {
+                    unique_lock<mutex> lock(stateMutex);
+                    wake.wait(lock, [&]{ return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                }
+                runChunks(id);
+                {
+                    lock_guard<mutex> lock(stateMutex);
+                    if (--pending == 0) done.notify_one();
+                }
+            }
+        }
+
+        void runChunks(int worker){
+            while (true) {
+                size_t chunk = nextChunk++;
+                if (chunk >= chunkCount) break;
+                size_t begin = chunk * grain;
+                (*job)(begin, min(begin + grain, count), worker);
+            }
+        }
+
+        vector<thread>      workers;
+        mutex               callMutex, stateMutex;
+        condition_variable  wake, done;
+        bool                stopping;
+        uint64_t            generation;
+        int                 pending;
+
+        const Job*          job;
+        size_t              count, grain, chunkCount;
+        atomic<size_t>      nextChunk;
+
+    public:
+
+        WorkerPool(int numWorkers=-1){
+            if (numWorkers < 0) numWorkers = max((int) thread::hardware_concurrency() - 1, 0);
+            stopping = false;
+            generation = 0;
+            pending = 0;
+            job = nullptr;
+            count = grain = chunkCount = 0;
+            nextChunk = 0;
+            for (int i = 0; i < numWorkers; i++) {
+                workers.push_back(thread(&WorkerPool::workerLoop, this, i + 1));
+            }
+        }
+
+        ~WorkerPool(){
+            {
+                lock_guard<mutex> lock(stateMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto & w : workers) w.join();
+        }
+
+        // Shared pool used by the simulation and render stages
+        static WorkerPool& shared(){
+            static WorkerPool pool;
+            return pool;
+        }
+
+        void parallelFor(size_t n, size_t grainSize, const Job& fn){
+            if (n == 0) return;
+            grainSize = max(grainSize, (size_t) 1);
+            unique_lock<mutex> serial(callMutex, try_to_lock);
+            if (workers.empty() || n <= grainSize || !serial.owns_lock()) {
+                fn(0, n, 0);
+                return;
+            }
+            {
+                lock_guard<mutex> lock(stateMutex);
+                job = &fn;
+                count = n;
+                grain = grainSize;
+                chunkCount = (n + grainSize - 1) / grainSize;
+                nextChunk = 0;
+                pending = workers.size();
+                generation++;
+            }
+            wake.notify_all();
+            runChunks(0);
+            unique_lock<mutex> lock(stateMutex);
+            done.wait(lock, [&]{ return pending == 0; });
+        }
+
+        // Number of threads that may run a job at once, caller included
+        int size() const {
+            return workers.size() + 1;
+        }
+    };
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MSAPhysics3D.h"
+#include "WorkerPool.h"
+#include "Constants.h"
+#include <unordered_map>
+
+
+namespace em {
+    // Springs as XPBD distance constraints. While active it takes the
+    // springs over from MSA by zeroing their strength (the original is kept
+    // and restored on release), lets MSA integrate the free motion and then
+    // projects the constraints on the predicted positions. Corrections are
+    // applied with moveBy(.., false) so they also become velocity, as in
+    // position based dynamics. Constraints are greedily coloured so no two
+    // in a batch share a particle and each batch is solved in parallel.
+    class XpbdSolver {
+
+        struct Constraint {
+            uint32_t    a, b;
+            float       rest;
+            float       compliance;     // inverse stiffness, scaled from the spring strength
+            float       lambda;
+        };
+
+        typedef msa::physics::Spring3D Spring;
+
+        void gatherParticles(msa::physics::World3D& physics){
+            size_t n = physics.numberOfParticles();
+            bool changed = n != particles.size();
+            particles.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                auto p = physics.getParticle(i);
+                if (particles[i] != p) changed = true;
+                particles[i] = p;
+            }
+            if (changed) {
+                indexOf.clear();
+                for (size_t i = 0; i < n; i++) indexOf[particles[i]] = i;
+                topologyDirty = true;
+            }
+        }
+
+        void gatherSprings(msa::physics::World3D& physics){
+            size_t n = physics.numberOfSprings();
+            if (n != springs.size()) topologyDirty = true;
+            springs.resize(n);
+            springOn.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                auto s = (Spring *) physics.getSpring(i);
+                bool on = s->isOn();
+                if (springs[i] != s || springOn[i] != on) topologyDirty = true;
+                springs[i] = s;
+                springOn[i] = on;
+
+                // Take the spring away from MSA, remembering its strength
+                if (s->getStrength() != 0) {
+                    strengths[s] = s->getStrength();
+                    s->setStrength(0);
+                    topologyDirty = true;
+                }
+            }
+        }
+
+        void buildConstraints(float compliance){
+            constraints.clear();
+            vector<uint64_t> used(particles.size(), 0);
+            vector<int> colorOf;
+            numColors = 0;
+            for (size_t i = 0; i < springs.size(); i++) {
+                if (!springOn[i]) continue;
+                Spring* s = springs[i];
+                auto ia = indexOf.find(s->getOneEnd());
+                auto ib = indexOf.find(s->getTheOtherEnd());
+                if (ia == indexOf.end() || ib == indexOf.end()) continue;
+                auto found = strengths.find(s);
+                float strength = found != strengths.end() ? found->second : SPRING_MIN_STRENGTH;
+
+                Constraint c;
+                c.a = ia->second;
+                c.b = ib->second;
+                c.rest = s->getRestLength();
+                c.compliance = compliance * SPRING_MAX_STRENGTH / max(strength, 0.0001f);
+                c.lambda = 0;
+
+                // Lowest colour free at both ends, overflow goes to a last serial batch
+                uint64_t taken = used[c.a] | used[c.b];
+                int color = XPBD_MAX_COLORS;
+                for (int k = 0; k < XPBD_MAX_COLORS; k++) {
+                    if (!(taken >> k & 1)) {
+                        color = k;
+                        used[c.a] |= 1ull << k;
+                        used[c.b] |= 1ull << k;
+                        break;
+                    }
+                }
+                numColors = max(numColors, color + 1);
+                constraints.push_back(c);
+                colorOf.push_back(color);
+            }
+
+            // Counting sort into colour batches
+            batchStart.assign(numColors + 1, 0);
+            for (auto c : colorOf) batchStart[c + 1]++;
+            for (int k = 0; k < numColors; k++) batchStart[k + 1] += batchStart[k];
+            vector<Constraint> sorted(constraints.size());
+            vector<uint32_t> cursor(batchStart.begin(), batchStart.end() - 1);
+            for (size_t i = 0; i < constraints.size(); i++) sorted[cursor[colorOf[i]]++] = constraints[i];
+            constraints.swap(sorted);
+            builtCompliance = compliance;
+            topologyDirty = false;
+        }
+
+        void project(Constraint& c, float dt2){
+            float wa = invMass[c.a], wb = invMass[c.b];
+            float alpha = c.compliance / dt2;
+            if (wa + wb + alpha == 0) return;
+            ofVec3f d = positions[c.a] - positions[c.b];
+            float len = d.length();
+            if (len < 1e-6f) return;
+            float C = len - c.rest;
+            float dLambda = (-C - alpha * c.lambda) / (wa + wb + alpha);
+            c.lambda += dLambda;
+            ofVec3f n = d / len;
+            positions[c.a] += n * (wa * dLambda);
+            positions[c.b] -= n * (wb * dLambda);
+        }
+
+        vector<msa::physics::Particle3D*>   particles;
+        unordered_map<void*, uint32_t>      indexOf;
+        vector<Spring*>                     springs;
+        vector<uint8_t>                     springOn;
+        unordered_map<Spring*, float>       strengths;
+        vector<Constraint>                  constraints;
+        vector<uint32_t>                    batchStart;
+        vector<ofVec3f>                     positions, predicted;
+        vector<float>                       invMass;
+        int                                 numColors;
+        float                               builtCompliance;
+        bool                                topologyDirty;
+
+    public:
+
+        // Plain copy of the parameters the step reads, see getSettings()
+        struct Settings {
+            bool    enabled;
+            float   compliance;
+            int     iterations;
+        };
+
+        XpbdSolver(){
+            numColors = 0;
+            builtCompliance = -1;
+            topologyDirty = true;
+        }
+
+        void setup(){
+            params.setName("XPBD");
+            params.add(enabled.set("XPBD springs", false));
+            params.add(compliance.set("Compliance", 0.0001, 0, 0.01));
+            params.add(iterations.set("Iterations", 4, 1, 32));
+            stats.setName("Stats");
+            stats.add(colorCount.set("Colours", 0));
+            params.add(stats);
+        }
+
+        // Before physics.update(): hands springs over and rebuilds batches if needed
+        void prepare(msa::physics::World3D& physics, const Settings& s){
+            gatherParticles(physics);
+            gatherSprings(physics);
+            if (topologyDirty || builtCompliance != s.compliance) buildConstraints(s.compliance);
+        }
+
+        // Read on the main thread, the step only sees the copy
+        Settings getSettings() const {
+            Settings s;
+            s.enabled = enabled;
+            s.compliance = compliance;
+            s.iterations = iterations;
+            return s;
+        }
+
+        // Counters go to the gui from the main thread, never from the step
+        void publishStats(){
+            colorCount.set(numColors);
+        }
+
+        // After physics.update(): projects constraints on the predicted positions
+        void solve(msa::physics::World3D& physics, const Settings& s, float dt, WorkerPool& pool=WorkerPool::shared()){
+            size_t n = particles.size();
+            if (n == 0 || constraints.empty() || n != physics.numberOfParticles()) return;
+            positions.resize(n);
+            invMass.resize(n);
+            pool.parallelFor(n, 1024, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    auto p = particles[i];
+                    positions[i] = p->getPosition();
+                    invMass[i] = p->isFixed() || p->getMass() <= 0 ? 0 : 1.f / p->getMass();
+                }
+            });
+            predicted = positions;
+            for (auto & c : constraints) c.lambda = 0;
+
+            float dt2 = dt * dt;
+            for (int it = 0; it < s.iterations; it++) {
+                for (int k = 0; k < numColors; k++) {
+                    uint32_t first = batchStart[k], last = batchStart[k + 1];
+                    // The overflow batch may share particles, keep it serial
+                    if (k == XPBD_MAX_COLORS) {
+                        for (uint32_t i = first; i < last; i++) project(constraints[i], dt2);
+                        continue;
+                    }
+                    pool.parallelFor(last - first, 512, [&](size_t begin, size_t end, int){
+                        for (size_t i = begin; i < end; i++) project(constraints[first + i], dt2);
+                    });
+                }
+            }
+
+            pool.parallelFor(n, 1024, [&](size_t begin, size_t end, int){
+                for (size_t i = begin; i < end; i++) {
+                    ofVec3f delta = positions[i] - predicted[i];
+                    if (delta.x != 0 || delta.y != 0 || delta.z != 0) particles[i]->moveBy(delta, false);
+                }
+            });
+        }
+
+        // Gives the springs back to MSA at their original strength
+        void release(){
+            for (auto s : springs) {
+                auto found = strengths.find(s);
+                if (found != strengths.end()) s->setStrength(found->second);
+            }
+            clear();
+        }
+
+        // Forget everything without touching springs, for when the world was cleared
+        void clear(){
+            strengths.clear();
+            particles.clear();
+            indexOf.clear();
+            springs.clear();
+            springOn.clear();
+            constraints.clear();
+            numColors = 0;
+            topologyDirty = true;
+        }
+
+        bool isHoldingSprings() const {
+            return !strengths.empty();
+        }
+
+        ofParameterGroup    params;
+        ofParameterGroup    stats;
+        ofParameter<bool>   enabled;
+        ofParameter<float>  compliance;
+        ofParameter<int>    iterations;
+        ofParameter<int>    colorCount;
+    };
+}
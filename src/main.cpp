@@ -1,8 +1,32 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "em/SweepRunner.h"
+#include "em/Benchmarks.h"
+#include "em/SelfTest.h"
 
 
-int main(){
+int main(int argc, char* argv[]){
+    
+    // Batch parameter sweep, no window or GL context
+    em::SweepRunner::Settings sweep;
+    if (em::SweepRunner::parseArgs(argc, argv, sweep)) {
+        em::SweepRunner runner;
+        runner.run(sweep);
+        return 0;
+    }
+    
+    // Microbenchmarks, exits non-zero on a regression against the baseline
+    em::Benchmarks::Settings bench;
+    if (em::Benchmarks::parseArgs(argc, argv, bench)) {
+        em::Benchmarks benchmarks;
+        return benchmarks.run(bench) > 0 ? 1 : 0;
+    }
+    
+    // Correctness checks, exits non-zero on a failure
+    if (em::SelfTest::parseArgs(argc, argv)) {
+        em::SelfTest selfTest;
+        return selfTest.run() > 0 ? 1 : 0;
+    }
     
     int windowWidth = 900;
     int windowHeight = 720;
@@ -15,12 +15,10 @@ void ofApp::setup(){
 
     float width = ofGetWidth();
     float height = ofGetHeight();
+    frameStart = 0;
+    cpuMillis = 0;
     
-    for (int i=0; i<LIGHT_COUNT; i++){
-        em::SceneLight light;
-        light.setup(i);
-        lights.push_back(light);
-    }
+    lightManager.setup();
     
     bgImage.load("bg-light-gradient.png");
     meshGenerator.setup();
@@ -29,11 +27,11 @@ void ofApp::setup(){
     setupGui();
     gui.minimizeAll();
     restoreParams();
+    setupPresets();
     
     // Setup audio
     sampleRate = 44100;
-    wavePhase = 0;
-    pulsePhase = 0;
+    synth.setup(sampleRate);
 //    soundPlayer.load("08 Physics-Based Sound Synthesis for Games and Interactive Systems.mp3");
 //    soundPlayer.play();
     soundStream.setup(this, 0, 2, 44100, 256, 4);
@@ -54,15 +52,12 @@ void ofApp::setupGui(){
 //    gui.setDefaultHeight(16);
     gui.add(fps.set("FPS", 0));
     gui.add(sceneCam.params);
+    gui.add(sceneCam.recordingParams);
     
-    ofParameterGroup lightParams;
-    lightParams.setName("Lights");
-    lightParams.add(globalAmbient.set("Global ambient", ofFloatColor(.1,.1,.1), ofFloatColor(0,0,0), ofFloatColor(1,1,1)));
-    for (auto & light : lights) {
-        lightParams.add(light.params);
-    }
-    gui.add(lightParams);
+    gui.add(lightManager.params);
     gui.add(meshGenerator.params);
+    presets.setup();
+    gui.add(presets.params);
     gui.add(drawPolyMesh.set("Draw polygon mesh", true));
     gui.add(drawSpringMesh.set("Draw spring mesh", true));
     gui.add(drawWireframe.set("Draw wireframe", false));
@@ -70,17 +65,44 @@ void ofApp::setupGui(){
     gui.add(drawGrid.set("Draw grid", true));
     gui.add(drawGui.set("Keep settings open", true));
     gui.add(audioEnabled.set("Audio enabled", false));
+    frameCache.setup();
+    gui.add(frameCache.params);
+    governor.setup();
+    gui.add(governor.params);
+    for (auto p : {&drawPolyMesh, &drawSpringMesh, &drawWireframe, &drawLights, &drawGrid}) {
+        frameCache.watch(*p);
+    }
     
     
     audioEnabled.addListener(this, &ofApp::toggleAudio);
 }
 
+//--------------------------------------------------------------
+void ofApp::setupPresets(){
+    // Counters live in each module's "Stats" group
+    presets.ignoreGroups("Stats");
+    presets.ignore("Mesh Generator/Threaded physics");
+    presets.quiet("Mesh Generator/Z Depth");
+    presets.discrete("Mesh Generator/Batch Topology");
+    presets.add(sceneCam.params);
+    presets.add(lightManager.params);
+    presets.add(meshGenerator.params);
+    presets.load("presets.bin");
+}
+
 //--------------------------------------------------------------
 void ofApp::update(){
     
-    ofSetGlobalAmbientColor(globalAmbient);
+    // CPU time runs from here to the end of draw, vsync waits are left out
+    frameStart = ofGetElapsedTimeMicros();
+    if (governor.update(cpuMillis, gpuTimer.getMillis(), sceneCam.isRecording())) {
+        applyQuality();
+    }
+    
+    ofSetGlobalAmbientColor(lightManager.globalAmbient);
     fps.set(ofGetFrameRate());
     
+    presets.update();
     sceneCam.update();
     float bs = meshGenerator.boxSize / 2;
     meshGenerator.update();
@@ -96,15 +118,23 @@ void ofApp::update(){
     }
     rms = lastBuffer.getRMSAmplitude();
     
-    for (auto & light : lights) {
-        light.update(bs);
-    }
+    lightManager.update(bs, sceneCam.getCamera());
     
     ofSetColor(ofColor::white);
     ofSetLineWidth(1 + (rms * 30.));
     waveform.draw();
 }
 
+//--------------------------------------------------------------
+void ofApp::applyQuality(){
+    const em::QualityGovernor::Quality& q = governor.getQuality();
+    sceneCam.setSamples(q.samples);
+    meshGenerator.setSphereDetailBias(q.sphereBias);
+    meshGenerator.setStepLimit(q.stepLimit);
+    lightManager.setLightScale(q.lightScale);
+    frameCache.invalidate();
+}
+
 //--------------------------------------------------------------
 void ofApp::audioIn(float *input, int bufferSize, int nChannels){
     if (sceneCam.isRecording()){
@@ -114,42 +144,7 @@ void ofApp::audioIn(float *input, int bufferSize, int nChannels){
 
 //--------------------------------------------------------------
 void ofApp::audioOut(ofSoundBuffer &outBuffer){
-    // base frequency of the lowest sine wave in cycles per second (hertz)
-    float frequency = 172.5;
-    
-    // mapping frequencies from Hz into full oscillations of sin() (two pi)
-    float wavePhaseStep = (frequency / sampleRate) * TWO_PI;
-    float pulsePhaseStep = (0.5 / sampleRate) * TWO_PI;
-    
-    // this loop builds a buffer of audio containing 3 sine waves at different
-    // frequencies, and pulses the volume of each sine wave individually. In
-    // other words, 3 oscillators and 3 LFOs.
-    
-    for(size_t i = 0; i < outBuffer.getNumFrames(); i++) {
-        
-        // build up a chord out of sine waves at 3 different frequencies
-        float sampleLow = sin(wavePhase);
-        float sampleMid = sin(wavePhase * 1.5);
-        float sampleHi = sin(wavePhase * 2.0);
-        
-        // pulse each sample's volume
-        sampleLow *= sin(pulsePhase);
-        sampleMid *= sin(pulsePhase * 1.04);
-        sampleHi *= sin(pulsePhase * 1.09);
-        
-        float fullSample = (sampleLow + sampleMid + sampleHi);
-        
-        // reduce the full sample's volume so it doesn't exceed 1
-        fullSample *= 0.3;
-        
-        // write the computed sample to the left and right channels
-        outBuffer.getSample(i, 0) = fullSample;
-        outBuffer.getSample(i, 1) = fullSample;
-        
-        // get the two phase variables ready for the next sample
-        wavePhase += wavePhaseStep;
-        pulsePhase += pulsePhaseStep;
-    }
+    synth.process(outBuffer);
     
     unique_lock<mutex> lock(audioMutex);
     lastBuffer = outBuffer;
@@ -177,6 +172,33 @@ void ofApp::saveParams(bool showDialog){
 //--------------------------------------------------------------
 void ofApp::draw(){
     
+    gpuTimer.begin();
+    
+    // Re-render only when something visible changed, otherwise present the last frame
+    uint64_t revision = meshGenerator.getRevision() * 31 + presets.getRevision();
+    bool animating = !meshGenerator.physicsPaused || sceneCam.orbitCamera || sceneCam.isRecording()
+        || lightManager.isAnimating() || presets.isMorphing();
+    if (frameCache.needsRedraw(sceneCam.getCamera(), revision, animating)) {
+        drawScene();
+    }
+    
+    sceneCam.draw(sceneRect());
+    
+    if (drawGui) {
+        ofEnableAlphaBlending();
+        gui.draw();
+    }
+    
+    gpuTimer.end();
+    
+    // The next step ran alongside drawing, events after this change the world directly
+    meshGenerator.waitForPhysics();
+    cpuMillis = (ofGetElapsedTimeMicros() - frameStart) / 1000.f;
+}
+
+//--------------------------------------------------------------
+void ofApp::drawScene(){
+    
     sceneCam.beginScene();
     bgImage.draw(0, 0, FBO_WIDTH, FBO_HEIGHT);
     sceneCam.beginCamera();
@@ -184,9 +206,7 @@ void ofApp::draw(){
     ofEnableAlphaBlending();
     ofEnableLighting();
     if (drawLights) {
-        for (auto & light : lights) {
-            light.draw();
-        }
+        lightManager.draw();
     }
     if (drawGrid) {
         ofSetColor(255, 10);
@@ -195,21 +215,15 @@ void ofApp::draw(){
         bool labels = false;
         ofDrawGrid(stepSize, numberOfSteps, labels);
     }
-    meshGenerator.draw(drawPolyMesh, drawSpringMesh, drawWireframe);
+    lightManager.begin(meshGenerator.polygonDiffuse);
+    bool wireframe = drawWireframe || governor.getQuality().wireframe;
+    meshGenerator.draw(sceneCam.getCamera(), drawPolyMesh, drawSpringMesh, wireframe, lightManager.clustered);
+    lightManager.end();
     ofDisableDepthTest();
     ofDisableAlphaBlending();
     ofDisableLighting();
     sceneCam.endCamera();
     sceneCam.endScene();
-    
-    sceneCam.draw((ofGetWidth()-FBO_WIDTH/2)/2,
-                  (ofGetHeight()-FBO_HEIGHT/2)/2,
-                  FBO_WIDTH/2, FBO_HEIGHT/2);
-    
-    if (drawGui) {
-        ofEnableAlphaBlending();
-        gui.draw();
-    }
 }
 
 //--------------------------------------------------------------
@@ -224,6 +238,9 @@ void ofApp::keyPressed(int key){
         case 'c':
             meshGenerator.makeCluster();
             break;
+        case 'C':
+            meshGenerator.makeClusterBatch();
+            break;
         case 'o':
             sceneCam.orbitCamera = !sceneCam.orbitCamera;
             break;
@@ -237,6 +254,21 @@ void ofApp::keyPressed(int key){
         case 'l':
             restoreParams();
             break;
+        case 'p':
+            presets.store();
+            break;
+        case '[':
+            presets.recall(presets.next(-1));
+            break;
+        case ']':
+            presets.recall(presets.next(1));
+            break;
+        case '{':
+            presets.morphTo(presets.next(-1));
+            break;
+        case '}':
+            presets.morphTo(presets.next(1));
+            break;
         case 'F':
             ofToggleFullscreen();
             break;
@@ -257,21 +289,19 @@ void ofApp::keyPressed(int key){
             break;
             
         case '1':
-            lights[0].enabled = !lights[0].enabled;
+            lightManager.lights[0].enabled = !lightManager.lights[0].enabled;
             break;
         case '2':
-            lights[1].enabled = !lights[1].enabled;
+            lightManager.lights[1].enabled = !lightManager.lights[1].enabled;
             break;
         case '3':
-            lights[2].enabled = !lights[2].enabled;
+            lightManager.lights[2].enabled = !lightManager.lights[2].enabled;
             break;
         case '4':
-            lights[3].enabled = !lights[3].enabled;
+            lightManager.lights[3].enabled = !lightManager.lights[3].enabled;
             break;
         case '5':
-            for (auto & light : lights){
-                light.randomiseAmbientColor();
-            }
+            lightManager.randomiseAmbientColor();
             break;
         
         case '.':
@@ -297,36 +327,38 @@ void ofApp::keyReleased(int key){
 
 //--------------------------------------------------------------
 void ofApp::mouseMoved(int x, int y ){
+    ofVec3f origin, dir;
+    if (sceneCam.getRay(x, y, sceneRect(), origin, dir)) {
+        meshGenerator.hover(origin, dir);
+    }
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseDragged(int x, int y, int button){
+    ofVec3f origin, dir;
+    if (meshGenerator.isGrabbing() && sceneCam.getRay(x, y, sceneRect(), origin, dir)) {
+        meshGenerator.dragTo(origin, dir);
+    }
 }
 
 //--------------------------------------------------------------
 void ofApp::mousePressed(int x, int y, int button){
+    ofVec3f origin, dir;
+    if (!sceneCam.getRay(x, y, sceneRect(), origin, dir)) return;
     if (button == 0) {
-//        int n = physics.numberOfParticles();
-//        float nearestDistance = 0;
-//        ofVec2f nearestVertex;
-//        int nearestIndex = 0;
-//        ofVec2f mouse(x, y);
-//        for(int i = 0; i < n; i++) {
-//            ofVec3f cur = previewCam.worldToScreen(physics.getParticle(i)->getPosition());
-//            float distance = cur.distance(mouse);
-//            if(i == 0 || distance < nearestDistance) {
-//                nearestDistance = distance;
-//                nearestVertex = cur;
-//                nearestIndex = i;
-//            }
-//        }
-//        ofPoint pos = physics.getParticle(nearestIndex)->getPosition();
-//        previewCam.lookAt(pos);
+        // Drag a particle, or orbit the camera when nothing is hit
+        if (meshGenerator.grab(origin, dir)) sceneCam.setMouseInputEnabled(false);
+    } else if (button == 2) {
+        meshGenerator.togglePin(origin, dir);
     }
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseReleased(int x, int y, int button){
+    if (button == 0 && meshGenerator.isGrabbing()) {
+        meshGenerator.release();
+        sceneCam.setMouseInputEnabled(true);
+    }
 }
 
 //--------------------------------------------------------------
@@ -339,6 +371,7 @@ void ofApp::mouseExited(int x, int y){
 
 //--------------------------------------------------------------
 void ofApp::windowResized(int w, int h){
+    frameCache.invalidate();
 //    physics.clearWorldSize();
 //    physics.setWorldSize(ofPoint(-w, -h, -h), ofPoint(w, h, h));
 //    gui.setWidthElements(w/5);
@@ -6,8 +6,13 @@
 #include "ofxAnimatableFloat.h"
 #include "ofxAnimatableOfPoint.h"
 #include "em/SceneCamera.h"
-#include "em/SceneLight.h"
+#include "em/LightManager.h"
 #include "em/MeshGenerator.h"
+#include "em/PresetBank.h"
+#include "em/ChordSynth.h"
+#include "em/FrameCache.h"
+#include "em/QualityGovernor.h"
+#include "em/GpuTimer.h"
 #include "em/Constants.h"
 
 
@@ -17,6 +22,7 @@ public:
     void setup();
     void update();
     void draw();
+    void drawScene();
     void exit();
 
     void keyPressed(int key);
@@ -35,6 +41,8 @@ public:
 
     void restoreParams();
     void saveParams(bool showDialog = false);
+    void setupPresets();
+    void applyQuality();
     
     void audioOut(ofSoundBuffer &outBuffer);
     
@@ -49,6 +57,13 @@ public:
         }
     }
     
+    // Where the scene fbo is drawn in the window
+    inline ofRectangle sceneRect() const {
+        return ofRectangle((ofGetWidth()-FBO_WIDTH/2)/2,
+                           (ofGetHeight()-FBO_HEIGHT/2)/2,
+                           FBO_WIDTH/2, FBO_HEIGHT/2);
+    }
+    
     inline void reset(){
         meshGenerator.clear();
 //        sceneCam.setup(meshGenerator.getFixedParticlePosition(), "bg-light-gradient.png");
@@ -60,12 +75,17 @@ public:
     em::SceneCamera           sceneCam;
     ofImage                   bgImage;
     em::MeshGenerator         meshGenerator;
-    vector<em::SceneLight>    lights;
+    em::LightManager          lightManager;
+    em::PresetBank            presets;
+    em::FrameCache            frameCache;
+    em::QualityGovernor       governor;
+    em::GpuTimer              gpuTimer;
+    uint64_t                  frameStart;
+    float                     cpuMillis;
     
     // Sound
     double sampleRate;
-    double wavePhase;
-    double pulsePhase;
+    em::ChordSynth synth;
     
     mutex audioMutex;
     ofSoundBuffer lastBuffer;
@@ -77,7 +97,6 @@ public:
     ofxPanel             gui;
 
     ofParameter<float>          fps;
-    ofParameter<ofFloatColor>   globalAmbient;
     
     string settingsFileName;
     